@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.hpp"
+#include "mapped_file.hpp"
+
+// Directory of processed assets (mesh caches, decoded images, program
+// binaries), addressed by content. An entry's key hashes the source bytes,
+// the import flags and the version of the pipeline that produced it, so
+// editing a source, changing a flag or bumping a version simply misses; stale
+// entries are never read and age out.
+//
+// Entries are written to a temporary file, flushed to disk and renamed into
+// place, so readers, and restarts after a crash, only ever see complete
+// files. Reads refresh an entry's mtime, and every store prunes the least
+// recently used entries once the directory exceeds its size cap, along with
+// temporaries a crashed writer left behind.
+//
+// LEARNGL_CACHE_DIR overrides the directory (default ".cache"),
+// LEARNGL_CACHE_MAX_MB the cap (default 2048). LEARNGL_CACHE_DIR=off disables
+// the cache.
+class AssetCache {
+public:
+  // temporaries older than this are taken to be left by a crashed writer.
+  static constexpr int64_t STALE_TMP_SECONDS = 60 * 60;
+
+  AssetCache(std::string directory, uint64_t max_bytes)
+    : directory(std::move(directory)), max_bytes(max_bytes) {}
+
+  bool enabled() const { return !directory.empty(); }
+
+  // Key of the current contents of `source`. False if it cannot be read.
+  static bool file_key(const std::string &source, const char *kind,
+                       uint32_t version, const std::string &flags,
+                       uint64_t &key) {
+    MappedFile file;
+    if (!file.open(source)) {
+      return false;
+    }
+    key = bytes_key(file.data(), file.size(), kind, version, flags);
+    return true;
+  }
+
+  static uint64_t bytes_key(const void *data, size_t size, const char *kind,
+                            uint32_t version, const std::string &flags) {
+    Hasher64 hasher(version);
+    hasher.update(kind, std::strlen(kind) + 1);
+    hasher.update(flags.data(), flags.size());
+    uint64_t flags_size = flags.size();
+    hasher.update(&flags_size, sizeof(flags_size));
+    hasher.update(data, size);
+    return hasher.digest();
+  }
+
+  std::string path(uint64_t key, const char *kind) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.", (unsigned long long)key);
+    return directory + "/" + name + kind;
+  }
+
+  // Path of the entry if it exists, marking it as recently used; otherwise
+  // empty.
+  std::string find(uint64_t key, const char *kind) const {
+    if (!enabled()) {
+      return "";
+    }
+    std::string entry = path(key, kind);
+    if (utimensat(AT_FDCWD, entry.c_str(), nullptr, 0) != 0) {
+      return "";
+    }
+    return entry;
+  }
+
+  // Reads a whole entry into `out`.
+  bool load(uint64_t key, const char *kind, std::vector<uint8_t> &out) const {
+    std::string entry = find(key, kind);
+    MappedFile file;
+    if (entry.empty() || !file.open(entry)) {
+      return false;
+    }
+    out.assign(file.data(), file.data() + file.size());
+    return true;
+  }
+
+  // Creates an entry: `write` fills the temporary file it is given and
+  // returns true on success, then the file is renamed into place.
+  bool store(uint64_t key, const char *kind,
+             const std::function<bool(const std::string &)> &write) {
+    if (!enabled()) {
+      return false;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    // unique per process and call, so concurrent writers never share one.
+    static std::atomic<uint64_t> counter{0};
+    std::string entry = path(key, kind);
+    std::string tmp_path = entry + ".tmp" + std::to_string(getpid()) + "." +
+                           std::to_string(counter++);
+    if (!write(tmp_path) || !sync(tmp_path) ||
+        std::rename(tmp_path.c_str(), entry.c_str())) {
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+    prune();
+    return true;
+  }
+
+  bool store(uint64_t key, const char *kind, const void *data, size_t size) {
+    return store(key, kind, [&](const std::string &tmp_path) {
+      FILE *file = fopen(tmp_path.c_str(), "wb");
+      if (!file) {
+        return false;
+      }
+      bool written = fwrite(data, 1, size, file) == size;
+      return fclose(file) == 0 && written;
+    });
+  }
+
+  // Removes least recently used entries until the directory fits the cap,
+  // and stale temporaries.
+  void prune() {
+    std::lock_guard<std::mutex> lock(mutex);
+    struct Entry {
+      std::string path;
+      uint64_t size;
+      int64_t mtime_ns;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    int64_t now = (int64_t)std::time(nullptr);
+    std::error_code error;
+    for (const auto &file :
+         std::filesystem::directory_iterator(directory, error)) {
+      struct stat st;
+      std::string path = file.path().string();
+      if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      // recent temporaries belong to writers still at work.
+      if (file.path().filename().string().find(".tmp") != std::string::npos) {
+        if (now - (int64_t)st.st_mtim.tv_sec > STALE_TMP_SECONDS) {
+          std::remove(path.c_str());
+        }
+        continue;
+      }
+      int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+                         st.st_mtim.tv_nsec;
+      entries.push_back({path, (uint64_t)st.st_size, mtime_ns});
+      total += st.st_size;
+    }
+    if (total <= max_bytes) {
+      return;
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) {
+                return a.mtime_ns < b.mtime_ns;
+              });
+    for (const Entry &entry : entries) {
+      if (total <= max_bytes) {
+        break;
+      }
+      if (std::remove(entry.path.c_str()) == 0) {
+        total -= entry.size;
+      }
+    }
+  }
+
+private:
+  std::string directory;
+  uint64_t max_bytes;
+  std::mutex mutex;
+
+  // flushes a written file to disk, so a crash after the rename cannot
+  // leave a complete-looking entry with missing contents.
+  static bool sync(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    bool synced = fsync(fd) == 0;
+    return close(fd) == 0 && synced;
+  }
+};
+
+inline AssetCache &asset_cache() {
+  static AssetCache cache = [] {
+    const char *dir = std::getenv("LEARNGL_CACHE_DIR");
+    const char *max_mb = std::getenv("LEARNGL_CACHE_MAX_MB");
+    std::string directory = dir && *dir ? dir : ".cache";
+    if (directory == "off") {
+      directory.clear();
+    }
+    uint64_t mb =
+      max_mb && *max_mb ? std::strtoull(max_mb, nullptr, 10) : 2048;
+    return AssetCache(directory, mb << 20);
+  }();
+  return cache;
+}
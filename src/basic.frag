@@ -49,6 +49,8 @@ uniform Material material;
 uniform Spotlight spotlight;
 uniform DirectionalLight directionalLight;
 uniform PointLight pointLights[N_POINT_LIGHTS];
+// added to the lit color, e.g. for the mesh under the cursor.
+uniform vec3 highlight;
 
 vec3 calculateAmbient(vec3 light_ambient) {
     return vec3(texture(material.texture_diffuse1, texCoord)) * light_ambient;
@@ -117,5 +119,5 @@ void main() {
         finalColor += calculatePointLight(pointLights[i], fragPos, viewDir, normalView);
     }
 
-    FragColor = vec4(finalColor, 1.0f);
+    FragColor = vec4(finalColor + highlight, 1.0f);
 }
@@ -3,6 +3,8 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+// instanced draws: per-instance placement, see ModelInstanceSet.
+layout(location = 3) in mat4 aInstance;
 
 out vec3 normal;
 out vec3 fragPos;
@@ -11,11 +13,44 @@ out vec2 texCoord;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+// model then places the mesh within its instance, and normals leave in world
+// space; normalMatrix only has to take them into view space.
+uniform bool instanced;
+
+// packed meshes: aPos is unorm16 within the mesh AABB and aNormal.xy an
+// octahedral encoded normal.
+uniform bool packedVertex;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 octDecode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+// inverse transpose up to scale, which the fragment shader normalizes away.
+mat3 cofactor(mat3 m) {
+  mat3 c = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+  return dot(m[0], c[0]) < 0.0 ? -c : c;
+}
 
 void main() {
+  vec3 position = aPos;
   normal = aNormal;
+  if (packedVertex) {
+    position = positionOffset + aPos * positionScale;
+    normal = octDecode(aNormal.xy);
+  }
   texCoord = aTexCoord;
-  vec4 viewPos = view * model * vec4(aPos, 1.0);
+  mat4 placement = model;
+  if (instanced) {
+    placement = aInstance * model;
+    normal = cofactor(mat3(placement)) * normal;
+  }
+  vec4 viewPos = view * placement * vec4(position, 1.0);
   fragPos = viewPos.xyz;
   gl_Position = projection * viewPos;
 }
@@ -0,0 +1,422 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LEARNGL_BC_SSE 1
+#endif
+
+#include "thread_pool.hpp"
+
+// CPU encoder for the block-compressed texture formats GL can sample
+// directly: every 4x4 pixel block becomes 8 or 16 bytes.
+//
+//   BC1  RGB, 4 bpp: two RGB565 endpoints and 2-bit indices into the four
+//        colours on the line between them.
+//   BC3  RGBA, 8 bpp: a BC4 alpha block followed by a BC1 colour block.
+//   BC4  one channel, 4 bpp: two 8-bit endpoints and 3-bit indices into
+//        eight values between them.
+//
+// Endpoints come from the principal axis of the block's colours (BC1) or
+// its range (BC4) and are refined once by least squares against the chosen
+// indices. That is a fraction of what exhaustive encoders find, at a small
+// fraction of their cost. Index selection and the BC4 range use SSE2 where
+// available; levels are encoded and downsampled in bands of rows spread
+// over the worker pool. Nothing here touches GL.
+
+enum class BcFormat { NONE, BC1, BC3, BC4 };
+
+inline size_t bc_block_bytes(BcFormat format) {
+  return format == BcFormat::BC1 || format == BcFormat::BC4 ? 8 : 16;
+}
+
+// bytes of a `width` x `height` level, partial blocks included.
+inline size_t bc_level_bytes(BcFormat format, int width, int height) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+         bc_block_bytes(format);
+}
+
+namespace detail {
+
+inline uint16_t pack_565(const float c[3]) {
+  int r = (int)std::lround(std::clamp(c[0], 0.0f, 255.0f) * 31.0f / 255.0f);
+  int g = (int)std::lround(std::clamp(c[1], 0.0f, 255.0f) * 63.0f / 255.0f);
+  int b = (int)std::lround(std::clamp(c[2], 0.0f, 255.0f) * 31.0f / 255.0f);
+  return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+inline void unpack_565(uint16_t v, float c[3]) {
+  int r = v >> 11, g = v >> 5 & 63, b = v & 31;
+  c[0] = (float)(r << 3 | r >> 2);
+  c[1] = (float)(g << 2 | g >> 4);
+  c[2] = (float)(b << 3 | b >> 2);
+}
+
+// BC1 colour order along the line: endpoint 0, 2/3 + 1/3, 1/3 + 2/3,
+// endpoint 1.
+constexpr uint32_t BC1_ORDER[4] = {0, 2, 3, 1};
+
+// Indices of the 16 pixels (SoA r, g, b) for the palette from c0 to c1 by
+// projection onto the line between them: the nearest palette entry for
+// colours on the line, and close to it for the rest.
+inline uint32_t bc1_indices(const float r[16], const float g[16],
+                            const float b[16], const float c0[3],
+                            const float c1[3]) {
+  float d[3] = {c1[0] - c0[0], c1[1] - c0[1], c1[2] - c0[2]};
+  float length2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+  if (length2 == 0.0f) {
+    return 0;
+  }
+  // t scaled to 0..3 along the line, as r * dr + g * dg + b * db + offset.
+  float scale = 3.0f / length2;
+  float dr = d[0] * scale, dg = d[1] * scale, db = d[2] * scale;
+  float offset = -(c0[0] * d[0] + c0[1] * d[1] + c0[2] * d[2]) * scale;
+  uint32_t indices = 0;
+#ifdef LEARNGL_BC_SSE
+  const __m128 vr = _mm_set1_ps(dr), vg = _mm_set1_ps(dg),
+               vb = _mm_set1_ps(db), voffset = _mm_set1_ps(offset);
+  const __m128 half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.5f),
+               two = _mm_set1_ps(2.5f);
+  for (int i = 0; i < 16; i += 4) {
+    __m128 t = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(r + i), vr),
+                 _mm_mul_ps(_mm_loadu_ps(g + i), vg)),
+      _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(b + i), vb), voffset));
+    // steps passed: 0..3 is the position along the line.
+    int m0 = _mm_movemask_ps(_mm_cmpge_ps(t, half));
+    int m1 = _mm_movemask_ps(_mm_cmpge_ps(t, one));
+    int m2 = _mm_movemask_ps(_mm_cmpge_ps(t, two));
+    for (int lane = 0; lane < 4; lane++) {
+      uint32_t step = (m0 >> lane & 1) + (m1 >> lane & 1) + (m2 >> lane & 1);
+      indices |= BC1_ORDER[step] << (2 * (i + lane));
+    }
+  }
+#else
+  for (int i = 0; i < 16; i++) {
+    float t = (r[i] * dr + g[i] * dg) + (b[i] * db + offset);
+    uint32_t step = (t >= 0.5f) + (t >= 1.5f) + (t >= 2.5f);
+    indices |= BC1_ORDER[step] << (2 * i);
+  }
+#endif
+  return indices;
+}
+
+// least-squares endpoints for fixed BC1 indices. false if the indices do
+// not determine them (all pixels on one palette entry).
+inline bool bc1_refit(const float r[16], const float g[16], const float b[16],
+                      uint32_t indices, float c0[3], float c1[3]) {
+  // weight of endpoint 0 for each index.
+  static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+  float aa = 0, ab = 0, bb = 0, ax[3] = {}, bx[3] = {};
+  for (int i = 0; i < 16; i++) {
+    float a = weights[indices >> (2 * i) & 3], w = 1.0f - a;
+    aa += a * a;
+    ab += a * w;
+    bb += w * w;
+    const float p[3] = {r[i], g[i], b[i]};
+    for (int k = 0; k < 3; k++) {
+      ax[k] += a * p[k];
+      bx[k] += w * p[k];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (std::fabs(det) < 1e-6f) {
+    return false;
+  }
+  for (int k = 0; k < 3; k++) {
+    c0[k] = (ax[k] * bb - bx[k] * ab) / det;
+    c1[k] = (bx[k] * aa - ax[k] * ab) / det;
+  }
+  return true;
+}
+
+// smallest and largest of 16 values.
+inline void bc4_range(const uint8_t v[16], int &lo, int &hi) {
+#ifdef LEARNGL_BC_SSE
+  __m128i x = _mm_loadu_si128((const __m128i *)v);
+  __m128i mn = _mm_min_epu8(x, _mm_srli_si128(x, 8));
+  __m128i mx = _mm_max_epu8(x, _mm_srli_si128(x, 8));
+  mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 4));
+  mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 4));
+  mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 2));
+  mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 2));
+  mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 1));
+  mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 1));
+  lo = _mm_cvtsi128_si32(mn) & 0xff;
+  hi = _mm_cvtsi128_si32(mx) & 0xff;
+#else
+  lo = 255;
+  hi = 0;
+  for (int i = 0; i < 16; i++) {
+    lo = std::min(lo, (int)v[i]);
+    hi = std::max(hi, (int)v[i]);
+  }
+#endif
+}
+
+// position 0..7 of each value on the line from `hi` to `lo`.
+inline void bc4_steps(const uint8_t v[16], int hi, float scale,
+                      int32_t steps[16]) {
+#ifdef LEARNGL_BC_SSE
+  const __m128 vhi = _mm_set1_ps((float)hi), vscale = _mm_set1_ps(scale),
+               half = _mm_set1_ps(0.5f);
+  __m128i bytes = _mm_loadu_si128((const __m128i *)v);
+  __m128i zero = _mm_setzero_si128();
+  __m128i low = _mm_unpacklo_epi8(bytes, zero);
+  __m128i high = _mm_unpackhi_epi8(bytes, zero);
+  const __m128i words[4] = {
+    _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+    _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)};
+  for (int i = 0; i < 4; i++) {
+    __m128 t = _mm_add_ps(
+      _mm_mul_ps(_mm_sub_ps(vhi, _mm_cvtepi32_ps(words[i])), vscale), half);
+    _mm_storeu_si128((__m128i *)(steps + 4 * i), _mm_cvttps_epi32(t));
+  }
+#else
+  for (int i = 0; i < 16; i++) {
+    steps[i] = (int32_t)((float)(hi - v[i]) * scale + 0.5f);
+  }
+#endif
+}
+
+inline void put_u16(uint8_t *out, uint16_t v) {
+  out[0] = (uint8_t)v;
+  out[1] = (uint8_t)(v >> 8);
+}
+
+inline void put_u32(uint8_t *out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+} // namespace detail
+
+// 16 RGBA pixels, row by row, to an 8-byte BC1 block. Always uses the
+// four-colour mode (color0 > color1), so the block is also valid as the
+// colour half of BC3.
+inline void encode_bc1_block(const uint8_t rgba[64], uint8_t out[8]) {
+  using namespace detail;
+  alignas(16) float r[16], g[16], b[16];
+  float mean[3] = {};
+  for (int i = 0; i < 16; i++) {
+    r[i] = rgba[i * 4];
+    g[i] = rgba[i * 4 + 1];
+    b[i] = rgba[i * 4 + 2];
+    mean[0] += r[i];
+    mean[1] += g[i];
+    mean[2] += b[i];
+  }
+  for (float &m : mean) {
+    m /= 16.0f;
+  }
+
+  // principal axis of the colours by power iteration on their covariance.
+  float cov[6] = {};
+  for (int i = 0; i < 16; i++) {
+    float x = r[i] - mean[0], y = g[i] - mean[1], z = b[i] - mean[2];
+    cov[0] += x * x;
+    cov[1] += x * y;
+    cov[2] += x * z;
+    cov[3] += y * y;
+    cov[4] += y * z;
+    cov[5] += z * z;
+  }
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 4; iteration++) {
+    float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                     cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                     cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    float length = std::max(std::fabs(next[0]),
+                            std::max(std::fabs(next[1]), std::fabs(next[2])));
+    if (length == 0.0f) {
+      break;
+    }
+    for (int k = 0; k < 3; k++) {
+      axis[k] = next[k] / length;
+    }
+  }
+
+  // the extreme pixels along the axis, inset by 1/16 of the range as the
+  // palette's inner points then cover more of the block.
+  int lo = 0, hi = 0;
+  float lo_t = r[0] * axis[0] + g[0] * axis[1] + b[0] * axis[2];
+  float hi_t = lo_t;
+  for (int i = 1; i < 16; i++) {
+    float t = r[i] * axis[0] + g[i] * axis[1] + b[i] * axis[2];
+    if (t < lo_t) {
+      lo_t = t;
+      lo = i;
+    }
+    if (t > hi_t) {
+      hi_t = t;
+      hi = i;
+    }
+  }
+  float c0[3] = {r[hi], g[hi], b[hi]}, c1[3] = {r[lo], g[lo], b[lo]};
+  for (int k = 0; k < 3; k++) {
+    float inset = (c0[k] - c1[k]) / 16.0f;
+    c0[k] -= inset;
+    c1[k] += inset;
+  }
+
+  uint16_t e0 = 0, e1 = 0;
+  uint32_t indices = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    e0 = pack_565(c0);
+    e1 = pack_565(c1);
+    if (e0 == e1) {
+      indices = 0;
+      break;
+    }
+    if (e0 < e1) {
+      std::swap(e0, e1);
+    }
+    float p0[3], p1[3];
+    unpack_565(e0, p0);
+    unpack_565(e1, p1);
+    indices = bc1_indices(r, g, b, p0, p1);
+    if (pass == 1 || !bc1_refit(r, g, b, indices, c0, c1)) {
+      break;
+    }
+  }
+  put_u16(out, e0);
+  put_u16(out + 2, e1);
+  put_u32(out + 4, indices);
+}
+
+// 16 values, e.g. one channel of a block at a stride of 4, to an 8-byte
+// BC4 block in its eight-value mode.
+inline void encode_bc4_block(const uint8_t *values, int stride,
+                             uint8_t out[8]) {
+  using namespace detail;
+  uint8_t v[16];
+  for (int i = 0; i < 16; i++) {
+    v[i] = values[i * stride];
+  }
+  int lo, hi;
+  bc4_range(v, lo, hi);
+  out[0] = (uint8_t)hi;
+  out[1] = (uint8_t)lo;
+  uint64_t bits = 0;
+  if (hi > lo) {
+    // positions 1..6 between the endpoints are indices 2..7.
+    int32_t steps[16];
+    bc4_steps(v, hi, 7.0f / (float)(hi - lo), steps);
+    for (int i = 0; i < 16; i++) {
+      int step = steps[i];
+      uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+      bits |= index << (3 * i);
+    }
+  }
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = (uint8_t)(bits >> (8 * i));
+  }
+}
+
+inline void encode_bc_block(BcFormat format, const uint8_t rgba[64],
+                            uint8_t *out) {
+  switch (format) {
+  case BcFormat::BC1:
+    encode_bc1_block(rgba, out);
+    break;
+  case BcFormat::BC3:
+    encode_bc4_block(rgba + 3, 4, out);
+    encode_bc1_block(rgba, out + 8);
+    break;
+  case BcFormat::BC4:
+    encode_bc4_block(rgba, 4, out);
+    break;
+  case BcFormat::NONE:
+    break;
+  }
+}
+
+// rows of 4x4 blocks (BC) or pixels (downsampling) per parallel_for item.
+constexpr int BC_BAND_BLOCK_ROWS = 16;
+constexpr int BC_BAND_PIXEL_ROWS = 64;
+
+// Encodes a `width` x `height` RGBA level, appending bc_level_bytes() bytes
+// to `out`. Blocks past the right or bottom edge repeat the edge pixels.
+inline void encode_bc_level(BcFormat format, const uint8_t *rgba, int width,
+                            int height, std::vector<uint8_t> &out) {
+  size_t block_bytes = bc_block_bytes(format);
+  size_t offset = out.size();
+  out.resize(offset + bc_level_bytes(format, width, height));
+  uint8_t *level = out.data() + offset;
+  int block_rows = (height + 3) / 4;
+  size_t row_bytes = (size_t)((width + 3) / 4) * block_bytes;
+  size_t bands = (block_rows + BC_BAND_BLOCK_ROWS - 1) / BC_BAND_BLOCK_ROWS;
+  parallel_for(bands, [&](size_t band) {
+    int first = (int)band * BC_BAND_BLOCK_ROWS;
+    int last = std::min(block_rows, first + BC_BAND_BLOCK_ROWS);
+    uint8_t *dst = level + first * row_bytes;
+    uint8_t block[64];
+    for (int by = first * 4; by < last * 4; by += 4) {
+      for (int bx = 0; bx < width; bx += 4) {
+        for (int y = 0; y < 4; y++) {
+          int sy = std::min(by + y, height - 1);
+          for (int x = 0; x < 4; x++) {
+            int sx = std::min(bx + x, width - 1);
+            std::memcpy(block + (y * 4 + x) * 4,
+                        rgba + ((size_t)sy * width + sx) * 4, 4);
+          }
+        }
+        encode_bc_block(format, block, dst);
+        dst += block_bytes;
+      }
+    }
+  });
+}
+
+// Next mip level of an RGBA image: each pixel averages a 2x2 footprint,
+// clamped at odd edges.
+inline void downsample_rgba(const uint8_t *rgba, int width, int height,
+                            std::vector<uint8_t> &out) {
+  int w = std::max(1, width / 2), h = std::max(1, height / 2);
+  out.resize((size_t)w * h * 4);
+  size_t bands = (h + BC_BAND_PIXEL_ROWS - 1) / BC_BAND_PIXEL_ROWS;
+  parallel_for(bands, [&](size_t band) {
+    int first = (int)band * BC_BAND_PIXEL_ROWS;
+    int last = std::min(h, first + BC_BAND_PIXEL_ROWS);
+    for (int y = first; y < last; y++) {
+      int y0 = std::min(2 * y, height - 1);
+      int y1 = std::min(2 * y + 1, height - 1);
+      for (int x = 0; x < w; x++) {
+        int x0 = std::min(2 * x, width - 1);
+        int x1 = std::min(2 * x + 1, width - 1);
+        for (int k = 0; k < 4; k++) {
+          int sum = rgba[((size_t)y0 * width + x0) * 4 + k] +
+                    rgba[((size_t)y0 * width + x1) * 4 + k] +
+                    rgba[((size_t)y1 * width + x0) * 4 + k] +
+                    rgba[((size_t)y1 * width + x1) * 4 + k];
+          out[((size_t)y * w + x) * 4 + k] = (uint8_t)((sum + 2) / 4);
+        }
+      }
+    }
+  });
+}
+
+// Full mip chain of an RGBA image in `format`, level 0 first, down to 1x1.
+// Returns the number of levels.
+inline int encode_bc_mips(BcFormat format, std::vector<uint8_t> rgba,
+                          int width, int height, std::vector<uint8_t> &out) {
+  int levels = 0;
+  std::vector<uint8_t> next;
+  for (;;) {
+    encode_bc_level(format, rgba.data(), width, height, out);
+    levels++;
+    if (width == 1 && height == 1) {
+      return levels;
+    }
+    downsample_rgba(rgba.data(), width, height, next);
+    rgba.swap(next);
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
+}
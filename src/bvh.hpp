@@ -0,0 +1,399 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "vertex_format.hpp"
+
+struct Aabb {
+  glm::vec3 min = glm::vec3(FLT_MAX);
+  glm::vec3 max = glm::vec3(-FLT_MAX);
+
+  void grow(const glm::vec3 &p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+
+  void grow(const Aabb &box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+
+  bool empty() const { return min.x > max.x; }
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+
+  float surface_area() const {
+    if (empty()) {
+      return 0.0f;
+    }
+    glm::vec3 e = max - min;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+  }
+
+  // bounds of this box after `m`, via the absolute-value trick rather than
+  // its eight corners.
+  Aabb transformed(const glm::mat4 &m) const {
+    if (empty()) {
+      return *this;
+    }
+    glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.0f));
+    glm::vec3 e = (max - min) * 0.5f;
+    glm::vec3 r;
+    for (int i = 0; i < 3; i++) {
+      r[i] = std::abs(m[0][i]) * e.x + std::abs(m[1][i]) * e.y +
+             std::abs(m[2][i]) * e.z;
+    }
+    return {c - r, c + r};
+  }
+};
+
+// 32 bytes, two per cache line. An interior node (count == 0) has its
+// children at `first` and `first + 1`; a leaf owns primitives
+// [first, first + count) of Bvh::primitives.
+struct BvhNode {
+  glm::vec3 min;
+  uint32_t first;
+  glm::vec3 max;
+  uint32_t count;
+
+  bool leaf() const { return count != 0; }
+};
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode must stay 32 bytes");
+
+// Bounding volume hierarchy over abstract primitives given by their boxes.
+//
+// Built top down with the surface area heuristic, evaluated over a fixed
+// number of centroid bins per axis rather than every split candidate. Nodes
+// live in one array with siblings adjacent and every child after its
+// parent, so traversal walks a flat array and refit() is a single reverse
+// pass that keeps the topology and only updates boxes.
+class Bvh {
+public:
+  // deepest a tree gets, so traversal can use a fixed stack.
+  static constexpr uint32_t MAX_DEPTH = 64;
+
+  std::vector<BvhNode> nodes;
+  // primitive indices in leaf order.
+  std::vector<uint32_t> primitives;
+
+  bool empty() const { return nodes.empty(); }
+
+  size_t byte_size() const {
+    return nodes.capacity() * sizeof(BvhNode) +
+           primitives.capacity() * sizeof(uint32_t);
+  }
+
+  void build(const std::vector<Aabb> &bounds, uint32_t max_leaf_size = 4) {
+    nodes.clear();
+    primitives.resize(bounds.size());
+    if (bounds.empty()) {
+      return;
+    }
+    for (uint32_t i = 0; i < bounds.size(); i++) {
+      primitives[i] = i;
+    }
+    std::vector<glm::vec3> centers(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+      centers[i] = bounds[i].center();
+    }
+
+    // at most two nodes per primitive.
+    nodes.reserve(bounds.size() * 2);
+    nodes.push_back({glm::vec3(0.0f), 0, glm::vec3(0.0f),
+                     (uint32_t)bounds.size()});
+    // node index and depth.
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 1}};
+    while (!stack.empty()) {
+      auto [index, depth] = stack.back();
+      stack.pop_back();
+      subdivide(index, depth, bounds, centers, max_leaf_size, stack);
+    }
+    nodes.shrink_to_fit();
+  }
+
+  // Recomputes every node box from new primitive bounds, indexed like the
+  // ones given to build(). Cheaper than a rebuild, but the tree degrades if
+  // primitives move far relative to each other.
+  void refit(const std::vector<Aabb> &bounds) {
+    for (size_t i = nodes.size(); i-- > 0;) {
+      BvhNode &node = nodes[i];
+      Aabb box;
+      if (node.leaf()) {
+        for (uint32_t k = 0; k < node.count; k++) {
+          box.grow(bounds[primitives[node.first + k]]);
+        }
+      } else {
+        for (uint32_t child = node.first; child < node.first + 2; child++) {
+          box.grow(Aabb{nodes[child].min, nodes[child].max});
+        }
+      }
+      node.min = box.min;
+      node.max = box.max;
+    }
+  }
+
+  // false unless every child index points forward, every leaf range is
+  // within `primitive_count` and no path exceeds MAX_DEPTH, e.g. for trees
+  // read from a file.
+  bool valid(size_t primitive_count) const {
+    if (primitives.size() != primitive_count) {
+      return false;
+    }
+    for (uint32_t p : primitives) {
+      if (p >= primitive_count) {
+        return false;
+      }
+    }
+    // children come after their parent, so depths are final when visited.
+    std::vector<uint32_t> depths(nodes.size(), 1);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      const BvhNode &node = nodes[i];
+      uint64_t end = (uint64_t)node.first + (node.leaf() ? node.count : 2);
+      if (node.leaf() ? end > primitives.size()
+                      : node.first <= i || end > nodes.size() ||
+                          depths[i] >= MAX_DEPTH) {
+        return false;
+      }
+      if (!node.leaf()) {
+        depths[node.first] = depths[node.first + 1] = depths[i] + 1;
+      }
+    }
+    return true;
+  }
+
+  // Depth-first walk: `enter(node)` decides whether to descend into a node,
+  // `leaf(primitive)` is called for each primitive of the leaves reached.
+  template <typename Enter, typename Leaf>
+  void traverse(Enter enter, Leaf leaf) const {
+    if (nodes.empty()) {
+      return;
+    }
+    // one pending sibling per level.
+    uint32_t stack[MAX_DEPTH];
+    uint32_t depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+      const BvhNode &node = nodes[stack[--depth]];
+      if (!enter(node)) {
+        continue;
+      }
+      if (node.leaf()) {
+        for (uint32_t k = 0; k < node.count; k++) {
+          leaf(primitives[node.first + k]);
+        }
+      } else {
+        stack[depth++] = node.first + 1;
+        stack[depth++] = node.first;
+      }
+    }
+  }
+
+private:
+  static constexpr int BINS = 16;
+  // cost of visiting a node relative to testing one primitive.
+  static constexpr float TRAVERSAL_COST = 1.0f;
+
+  void subdivide(uint32_t index, uint32_t depth,
+                 const std::vector<Aabb> &bounds,
+                 const std::vector<glm::vec3> &centers, uint32_t max_leaf_size,
+                 std::vector<std::pair<uint32_t, uint32_t>> &stack) {
+    uint32_t first = nodes[index].first;
+    uint32_t count = nodes[index].count;
+    Aabb box, center_box;
+    for (uint32_t k = first; k < first + count; k++) {
+      box.grow(bounds[primitives[k]]);
+      center_box.grow(centers[primitives[k]]);
+    }
+    nodes[index].min = box.min;
+    nodes[index].max = box.max;
+    if (count <= max_leaf_size || depth >= MAX_DEPTH) {
+      return;
+    }
+
+    // best binned split over all three axes.
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_bin = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      float lo = center_box.min[axis];
+      float extent = center_box.max[axis] - lo;
+      if (extent <= 0.0f) {
+        continue;
+      }
+      float scale = BINS / extent;
+      Aabb bin_boxes[BINS];
+      uint32_t bin_counts[BINS] = {};
+      for (uint32_t k = first; k < first + count; k++) {
+        int bin = std::min(
+          BINS - 1, (int)((centers[primitives[k]][axis] - lo) * scale));
+        bin_boxes[bin].grow(bounds[primitives[k]]);
+        bin_counts[bin]++;
+      }
+
+      // left-to-right prefix areas, then a right-to-left sweep.
+      float left_area[BINS - 1];
+      uint32_t left_count[BINS - 1];
+      Aabb left;
+      uint32_t n = 0;
+      for (int i = 0; i < BINS - 1; i++) {
+        left.grow(bin_boxes[i]);
+        n += bin_counts[i];
+        left_area[i] = left.surface_area();
+        left_count[i] = n;
+      }
+      Aabb right;
+      n = 0;
+      for (int i = BINS - 1; i > 0; i--) {
+        right.grow(bin_boxes[i]);
+        n += bin_counts[i];
+        if (left_count[i - 1] == 0 || n == 0) {
+          continue;
+        }
+        float cost =
+          left_count[i - 1] * left_area[i - 1] + n * right.surface_area();
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = i;
+        }
+      }
+    }
+
+    // stay a leaf if splitting does not pay, unless the leaf would be large.
+    float leaf_cost = count * box.surface_area();
+    float split_cost = TRAVERSAL_COST * box.surface_area() + best_cost;
+    if (best_axis < 0 ||
+        (split_cost >= leaf_cost && count <= 4 * max_leaf_size)) {
+      return;
+    }
+
+    float lo = center_box.min[best_axis];
+    float scale = BINS / (center_box.max[best_axis] - lo);
+    uint32_t *begin = primitives.data() + first;
+    uint32_t *middle =
+      std::partition(begin, begin + count, [&](uint32_t primitive) {
+        int bin = std::min(
+          BINS - 1, (int)((centers[primitive][best_axis] - lo) * scale));
+        return bin < best_bin;
+      });
+    uint32_t left_count = middle - begin;
+
+    uint32_t left = nodes.size();
+    nodes.push_back({glm::vec3(0.0f), first, glm::vec3(0.0f), left_count});
+    nodes.push_back({glm::vec3(0.0f), first + left_count, glm::vec3(0.0f),
+                     count - left_count});
+    nodes[index].first = left;
+    nodes[index].count = 0;
+    stack.push_back({left + 1, depth + 1});
+    stack.push_back({left, depth + 1});
+  }
+};
+
+// Bottom level: a Bvh over the triangles of one mesh (its level 0 indices),
+// with its own copy of the vertex positions so queries work whatever the
+// mesh keeps of its geometry. Triangles are stored in leaf order, so a leaf
+// reads one contiguous run.
+struct TriangleBvh {
+  Bvh bvh;
+  std::vector<glm::vec3> positions;
+  // vertex indices, three per triangle, in leaf order. triangle `i` here is
+  // triangle bvh.primitives[i] of the mesh.
+  std::vector<uint32_t> triangles;
+
+  bool empty() const { return bvh.empty(); }
+
+  size_t byte_size() const {
+    return bvh.byte_size() + positions.capacity() * sizeof(glm::vec3) +
+           triangles.capacity() * sizeof(uint32_t);
+  }
+
+  // `indices` are `index_size` (2 or 4) bytes wide.
+  static TriangleBvh build(const Vertex *vertices, size_t vertex_count,
+                           const void *indices, size_t index_count,
+                           uint32_t index_size) {
+    TriangleBvh out;
+    if (!out.set_geometry(vertices, vertex_count, indices, index_count,
+                          index_size)) {
+      return TriangleBvh();
+    }
+    std::vector<Aabb> bounds = out.triangle_bounds();
+    out.bvh.build(bounds);
+    out.reorder();
+    return out;
+  }
+
+  // Rebuilds the queryable form from a stored tree without re-running the
+  // build. False if the tree does not fit the geometry.
+  static bool assemble(Bvh bvh, const Vertex *vertices, size_t vertex_count,
+                       const void *indices, size_t index_count,
+                       uint32_t index_size, TriangleBvh &out) {
+    out = TriangleBvh();
+    if (!bvh.valid(index_count / 3) ||
+        !out.set_geometry(vertices, vertex_count, indices, index_count,
+                          index_size)) {
+      return false;
+    }
+    out.bvh = std::move(bvh);
+    out.reorder();
+    return true;
+  }
+
+  // Call after moving `positions` (e.g. for a deformed mesh).
+  void refit() {
+    std::vector<Aabb> bounds(triangles.size() / 3);
+    for (size_t i = 0; i < bounds.size(); i++) {
+      for (int k = 0; k < 3; k++) {
+        bounds[bvh.primitives[i]].grow(positions[triangles[i * 3 + k]]);
+      }
+    }
+    bvh.refit(bounds);
+  }
+
+private:
+  // positions and triangles in mesh order; false on out-of-range indices.
+  bool set_geometry(const Vertex *vertices, size_t vertex_count,
+                    const void *indices, size_t index_count,
+                    uint32_t index_size) {
+    positions.resize(vertex_count);
+    for (size_t i = 0; i < vertex_count; i++) {
+      positions[i] = vertices[i].position;
+    }
+    triangles.resize(index_count / 3 * 3);
+    for (size_t i = 0; i < triangles.size(); i++) {
+      triangles[i] = index_size == 2 ? ((const uint16_t *)indices)[i]
+                                     : ((const uint32_t *)indices)[i];
+      if (triangles[i] >= vertex_count) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::vector<Aabb> triangle_bounds() const {
+    std::vector<Aabb> bounds(triangles.size() / 3);
+    for (size_t t = 0; t < bounds.size(); t++) {
+      for (int k = 0; k < 3; k++) {
+        bounds[t].grow(positions[triangles[t * 3 + k]]);
+      }
+    }
+    return bounds;
+  }
+
+  void reorder() {
+    std::vector<uint32_t> ordered(triangles.size());
+    for (size_t i = 0; i < bvh.primitives.size(); i++) {
+      uint32_t t = bvh.primitives[i];
+      for (int k = 0; k < 3; k++) {
+        ordered[i * 3 + k] = triangles[t * 3 + k];
+      }
+    }
+    triangles = std::move(ordered);
+  }
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <filesystem>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Reports files under a directory tree that were written or moved into
+// place, so assets can be reloaded while the app runs. Built on inotify;
+// elsewhere it never reports anything.
+//
+// Only completed writes count (IN_CLOSE_WRITE, IN_MOVED_TO), so a file is
+// never reported while an editor is still writing it. Directories created
+// later are watched as they appear.
+class FileWatcher {
+public:
+  explicit FileWatcher(const std::string &root) {
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+      perror("inotify_init1");
+      return;
+    }
+    watch_tree(root);
+#else
+    (void)root;
+#endif
+  }
+
+  ~FileWatcher() {
+#ifdef __linux__
+    if (fd >= 0) {
+      close(fd);
+    }
+#endif
+  }
+
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  // Paths changed since the last call, each once. Never blocks.
+  std::vector<std::string> poll() {
+    std::vector<std::string> changed;
+#ifdef __linux__
+    if (fd < 0) {
+      return changed;
+    }
+    alignas(inotify_event) char buffer[4096];
+    for (;;) {
+      ssize_t n = read(fd, buffer, sizeof(buffer));
+      if (n <= 0) {
+        break;
+      }
+      for (char *p = buffer; p < buffer + n;) {
+        const inotify_event *event = (const inotify_event *)p;
+        p += sizeof(inotify_event) + event->len;
+        auto dir = directories.find(event->wd);
+        if (dir == directories.end() || event->len == 0) {
+          continue;
+        }
+        std::string path = dir->second + "/" + event->name;
+        if (event->mask & IN_ISDIR) {
+          if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            watch_tree(path);
+          }
+          continue;
+        }
+        // a file's IN_CREATE comes before its contents.
+        if (!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+          continue;
+        }
+        bool seen = false;
+        for (const std::string &other : changed) {
+          seen = seen || other == path;
+        }
+        if (!seen) {
+          changed.push_back(path);
+        }
+      }
+    }
+#endif
+    return changed;
+  }
+
+private:
+#ifdef __linux__
+  int fd = -1;
+  // watch descriptor to directory path.
+  std::unordered_map<int, std::string> directories;
+
+  void watch_tree(const std::string &root) {
+    add_watch(root);
+    std::error_code error;
+    for (std::filesystem::recursive_directory_iterator it(root, error), end;
+         !error && it != end; it.increment(error)) {
+      if (it->is_directory(error)) {
+        add_watch(it->path().string());
+      }
+    }
+  }
+
+  void add_watch(const std::string &directory) {
+    int wd = inotify_add_watch(fd, directory.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                 IN_ONLYDIR);
+    if (wd < 0) {
+      fprintf(stderr, "Cannot watch %s\n", directory.c_str());
+      return;
+    }
+    directories[wd] = directory;
+  }
+#endif
+};
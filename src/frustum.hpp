@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// View frustum as six inward-facing planes (a, b, c, d) with ax + by + cz + d
+// >= 0 inside. Built from a clip matrix, the planes live in whatever space
+// the matrix transforms from, e.g. object space for projection * view *
+// model.
+struct Frustum {
+  glm::vec4 planes[6];
+
+  // Gribb & Hartmann plane extraction.
+  static Frustum from_matrix(const glm::mat4 &m) {
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++) {
+      row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    }
+
+    Frustum f;
+    f.planes[0] = row[3] + row[0]; // left
+    f.planes[1] = row[3] - row[0]; // right
+    f.planes[2] = row[3] + row[1]; // bottom
+    f.planes[3] = row[3] - row[1]; // top
+    f.planes[4] = row[3] + row[2]; // near
+    f.planes[5] = row[3] - row[2]; // far
+    for (auto &plane : f.planes) {
+      float length = glm::length(glm::vec3(plane));
+      if (length > 0.0f) {
+        plane = plane / length;
+      }
+    }
+    return f;
+  }
+
+  bool intersects_sphere(const glm::vec3 &center, float radius) const {
+    for (const auto &plane : planes) {
+      if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <glad/glad.h>
+
+#include "vertex_format.hpp"
+
+// One vertex buffer and one index buffer shared by all meshes of a model,
+// with one VAO per vertex format. Meshes are appended as they arrive and
+// address their slice with a base vertex and an index byte offset, so
+// consecutive meshes of the same format draw without switching VAOs.
+//
+// The buffers grow geometrically; growing copies the old contents on the GPU
+// with glCopyBufferSubData and re-points the VAOs. GL thread only.
+class GeometryArena {
+public:
+  GeometryArena() = default;
+
+  ~GeometryArena() {
+    for (unsigned int &vao : vaos) {
+      if (vao != 0) {
+        glDeleteVertexArrays(1, &vao);
+      }
+    }
+    glDeleteBuffers(1, &vertices.id);
+    glDeleteBuffers(1, &indices.id);
+  }
+
+  GeometryArena(const GeometryArena &) = delete;
+  GeometryArena &operator=(const GeometryArena &) = delete;
+
+  // exchanges the buffers and VAOs; meshes address them by name and offset,
+  // so they move along with their arena.
+  void swap(GeometryArena &other) noexcept {
+    std::swap(vertices, other.vertices);
+    std::swap(indices, other.indices);
+    std::swap(vaos, other.vaos);
+  }
+
+  static size_t stride(VertexFormat format) {
+    return format == VertexFormat::PACKED ? sizeof(PackedVertex)
+                                          : sizeof(Vertex);
+  }
+
+  // avoids regrowing when the final size is known up front.
+  void reserve(size_t vertex_bytes, size_t index_bytes) {
+    grow(vertices, vertex_bytes);
+    grow(indices, index_bytes);
+  }
+
+  // Appends `count` vertices laid out as `format`. Returns their base vertex
+  // for the format's VAO.
+  GLint add_vertices(VertexFormat format, const void *data, size_t count) {
+    size_t size = stride(format);
+    // base vertices count in strides from the start of the buffer.
+    size_t offset = (vertices.used + size - 1) / size * size;
+    append(vertices, offset, data, count * size);
+    return (GLint)(offset / size);
+  }
+
+  // Appends `count` indices of `index_size` bytes. Returns their byte offset
+  // in the index buffer.
+  size_t add_indices(const void *data, size_t count, uint32_t index_size) {
+    size_t offset = (indices.used + 3) & ~size_t(3);
+    append(indices, offset, data, count * index_size);
+    return offset;
+  }
+
+  unsigned int vao(VertexFormat format) {
+    unsigned int &vao = vaos[(int)format];
+    if (vao == 0) {
+      glGenVertexArrays(1, &vao);
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, vertices.id);
+      setup_attributes(format);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.id);
+      glBindVertexArray(0);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    return vao;
+  }
+
+  size_t vertex_bytes() const { return vertices.used; }
+  size_t index_bytes() const { return indices.used; }
+  // allocated sizes, including room for growth.
+  size_t vertex_capacity() const { return vertices.capacity; }
+  size_t index_capacity() const { return indices.capacity; }
+
+private:
+  struct Buffer {
+    unsigned int id = 0;
+    size_t used = 0;
+    size_t capacity = 0;
+  };
+
+  static constexpr size_t MIN_CAPACITY = 1 << 20;
+
+  Buffer vertices;
+  Buffer indices;
+  unsigned int vaos[2] = {};
+
+  // uploads go through the copy targets so no VAO's element binding changes.
+  void append(Buffer &buffer, size_t offset, const void *data, size_t bytes) {
+    if (bytes == 0) {
+      return;
+    }
+    if (offset + bytes > buffer.capacity) {
+      grow(buffer, std::max(offset + bytes, buffer.capacity * 2));
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.id);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    buffer.used = offset + bytes;
+  }
+
+  void grow(Buffer &buffer, size_t capacity) {
+    if (capacity <= buffer.capacity) {
+      return;
+    }
+    capacity = std::max(capacity, MIN_CAPACITY);
+
+    unsigned int id;
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+    if (buffer.used > 0) {
+      glBindBuffer(GL_COPY_READ_BUFFER, buffer.id);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                          buffer.used);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (buffer.id != 0) {
+      glDeleteBuffers(1, &buffer.id);
+    }
+    buffer.id = id;
+    buffer.capacity = capacity;
+
+    // the VAOs still reference the old buffer.
+    for (int format = 0; format < 2; format++) {
+      if (vaos[format] == 0) {
+        continue;
+      }
+      glBindVertexArray(vaos[format]);
+      if (&buffer == &vertices) {
+        glBindBuffer(GL_ARRAY_BUFFER, vertices.id);
+        setup_attributes((VertexFormat)format);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      } else {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.id);
+      }
+      glBindVertexArray(0);
+    }
+  }
+
+  static void setup_attributes(VertexFormat format) {
+    if (format == VertexFormat::PACKED) {
+      // unorm16 positions within the mesh AABB, decoded in basic.vert
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+                            sizeof(PackedVertex),
+                            (void *)offsetof(PackedVertex, position));
+      // octahedral normals
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+                            (void *)offsetof(PackedVertex, normal));
+      // half float texture coords
+      glEnableVertexAttribArray(2);
+      glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE,
+                            sizeof(PackedVertex),
+                            (void *)offsetof(PackedVertex, tex_coords));
+      return;
+    }
+
+    // vertex positions
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+    // vertex normals
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, normal));
+    // vertex texture coords
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, tex_coords));
+  }
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "index_buffer.hpp"
+#include "vertex_format.hpp"
+
+// Lossless compression of optimized mesh geometry for host-side storage.
+//
+// Indices: each index minus the previous one, zigzag mapped and written as a
+// LEB128 varint. After vertex cache and fetch optimization neighbouring
+// indices are close, so most take one byte.
+//
+// Vertices: every 32-bit lane is XORed with the same lane of the previous
+// vertex, the results are split into byte planes (byte k of every lane),
+// and zero bytes are run-length coded. Neighbouring vertices share signs,
+// exponents and high mantissa bits, so the upper planes are mostly zeros.
+
+namespace detail {
+
+inline void put_varint(std::vector<uint8_t> &out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+inline bool get_varint(const uint8_t *&p, const uint8_t *end,
+                       uint32_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (p == end) {
+      return false;
+    }
+    uint8_t byte = *p++;
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (v >> 31); }
+inline int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+constexpr size_t VERTEX_LANES = sizeof(Vertex) / 4;
+
+} // namespace detail
+
+inline void encode_indices(const IndexBuffer &indices,
+                           std::vector<uint8_t> &out) {
+  using namespace detail;
+  uint32_t last = 0;
+  for (size_t i = 0; i < indices.size(); i++) {
+    uint32_t index = indices[i];
+    put_varint(out, zigzag((int32_t)(index - last)));
+    last = index;
+  }
+}
+
+// writes `count` indices of `element_size` bytes (2 or 4) to `out`.
+inline bool decode_indices(const uint8_t *data, size_t size, size_t count,
+                           uint32_t element_size, void *out) {
+  using namespace detail;
+  const uint8_t *p = data, *end = data + size;
+  uint32_t last = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t delta;
+    if (!get_varint(p, end, delta)) {
+      return false;
+    }
+    last += (uint32_t)unzigzag(delta);
+    if (element_size == 2) {
+      if (last > 0xffff) {
+        return false;
+      }
+      static_cast<uint16_t *>(out)[i] = (uint16_t)last;
+    } else {
+      static_cast<uint32_t *>(out)[i] = last;
+    }
+  }
+  return p == end;
+}
+
+inline bool decode_indices(const uint8_t *data, size_t size, size_t count,
+                           std::vector<unsigned int> &out) {
+  out.resize(count);
+  return decode_indices(data, size, count, 4, out.data());
+}
+
+inline void encode_vertices(const Vertex *vertices, size_t count,
+                            std::vector<uint8_t> &out) {
+  using namespace detail;
+  static_assert(sizeof(Vertex) % 4 == 0,
+                "Vertex must be made of 32-bit lanes");
+  std::vector<uint8_t> planes(count * sizeof(Vertex));
+  uint32_t previous[VERTEX_LANES] = {};
+  for (size_t v = 0; v < count; v++) {
+    uint32_t lanes[VERTEX_LANES];
+    std::memcpy(lanes, &vertices[v], sizeof(Vertex));
+    for (size_t l = 0; l < VERTEX_LANES; l++) {
+      uint32_t x = lanes[l] ^ previous[l];
+      previous[l] = lanes[l];
+      for (size_t b = 0; b < 4; b++) {
+        planes[(l * 4 + b) * count + v] = (uint8_t)(x >> (b * 8));
+      }
+    }
+  }
+
+  // a zero byte is followed by the number of further zeros.
+  for (size_t i = 0; i < planes.size();) {
+    out.push_back(planes[i]);
+    if (planes[i++] != 0) {
+      continue;
+    }
+    uint32_t run = 0;
+    while (i < planes.size() && planes[i] == 0 && run < UINT32_MAX) {
+      run++;
+      i++;
+    }
+    put_varint(out, run);
+  }
+}
+
+inline bool decode_vertices(const uint8_t *data, size_t size, size_t count,
+                            Vertex *out) {
+  using namespace detail;
+  std::vector<uint8_t> planes(count * sizeof(Vertex));
+  const uint8_t *p = data, *end = data + size;
+  for (size_t i = 0; i < planes.size();) {
+    if (p == end) {
+      return false;
+    }
+    uint8_t byte = *p++;
+    planes[i++] = byte;
+    if (byte != 0) {
+      continue;
+    }
+    uint32_t run;
+    if (!get_varint(p, end, run) || run > planes.size() - i) {
+      return false;
+    }
+    // `planes` is zero-initialized.
+    i += run;
+  }
+  if (p != end) {
+    return false;
+  }
+
+  uint32_t previous[VERTEX_LANES] = {};
+  for (size_t v = 0; v < count; v++) {
+    uint32_t lanes[VERTEX_LANES];
+    for (size_t l = 0; l < VERTEX_LANES; l++) {
+      uint32_t x = 0;
+      for (size_t b = 0; b < 4; b++) {
+        x |= (uint32_t)planes[(l * 4 + b) * count + v] << (b * 8);
+      }
+      lanes[l] = previous[l] ^= x;
+    }
+    std::memcpy(&out[v], lanes, sizeof(Vertex));
+  }
+  return true;
+}
+
+// A mesh's vertices and indices in the form above.
+struct CompressedGeometry {
+  uint32_t vertex_count = 0;
+  uint32_t index_count = 0;
+  std::vector<uint8_t> vertices;
+  std::vector<uint8_t> indices;
+
+  bool empty() const { return vertex_count == 0 && index_count == 0; }
+  size_t byte_size() const { return vertices.size() + indices.size(); }
+};
+
+inline CompressedGeometry compress_geometry(
+  const std::vector<Vertex> &vertices, const IndexBuffer &indices) {
+  CompressedGeometry geometry;
+  geometry.vertex_count = vertices.size();
+  geometry.index_count = indices.size();
+  encode_vertices(vertices.data(), vertices.size(), geometry.vertices);
+  encode_indices(indices, geometry.indices);
+  geometry.vertices.shrink_to_fit();
+  geometry.indices.shrink_to_fit();
+  return geometry;
+}
+
+inline bool decompress_geometry(const CompressedGeometry &geometry,
+                                std::vector<Vertex> &vertices,
+                                std::vector<unsigned int> &indices) {
+  vertices.resize(geometry.vertex_count);
+  return decode_vertices(geometry.vertices.data(), geometry.vertices.size(),
+                         geometry.vertex_count, vertices.data()) &&
+         decode_indices(geometry.indices.data(), geometry.indices.size(),
+                        geometry.index_count, indices);
+}
@@ -0,0 +1,553 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "json.hpp"
+#include "load_profiler.hpp"
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "scene_graph.hpp"
+#include "texture.hpp"
+
+// Binary glTF 2.0 (.glb) reader that leaves geometry in the mapped file.
+//
+// A primitive whose POSITION, NORMAL and TEXCOORD_0 accessors are floats
+// interleaved exactly like Vertex can be uploaded straight from the BIN
+// chunk, as can 16- and 32-bit indices; see gltf_direct_vertices() and
+// gltf_direct_indices(). Anything else is converted into MeshData by
+// gltf_mesh_data().
+//
+// glTF puts the texture origin at the top left, the opposite of OBJ. Rather
+// than flipping v, which would need a copy of every vertex, glTF images are
+// decoded without stb_image's vertical flip.
+
+// a triangle primitive and the scene graph node that places it.
+struct GltfPrimitive {
+  uint32_t node;
+  const JsonValue *json;
+};
+
+struct GltfScene {
+  // shared with image decodes that may outlive the load.
+  std::shared_ptr<MappedFile> file;
+  JsonValue json;
+  const unsigned char *bin = nullptr;
+  size_t bin_size = 0;
+  SceneGraph graph;
+  // in scene graph order.
+  std::vector<GltfPrimitive> primitives;
+};
+
+// typed elements in the BIN chunk, validated to lie within it.
+struct GltfAccessor {
+  const unsigned char *data;
+  size_t count;
+  size_t stride;
+  uint32_t component_type;
+  uint32_t components;
+  bool normalized;
+};
+
+namespace detail {
+
+constexpr uint32_t GLB_MAGIC = 0x46546c67; // "glTF"
+constexpr uint32_t GLB_CHUNK_JSON = 0x4e4f534a;
+constexpr uint32_t GLB_CHUNK_BIN = 0x004e4942;
+
+constexpr uint32_t GLTF_BYTE = 5120;
+constexpr uint32_t GLTF_UNSIGNED_BYTE = 5121;
+constexpr uint32_t GLTF_SHORT = 5122;
+constexpr uint32_t GLTF_UNSIGNED_SHORT = 5123;
+constexpr uint32_t GLTF_UNSIGNED_INT = 5125;
+constexpr uint32_t GLTF_FLOAT = 5126;
+constexpr uint32_t GLTF_TRIANGLES = 4;
+
+inline uint32_t gltf_component_size(uint32_t type) {
+  switch (type) {
+  case GLTF_BYTE:
+  case GLTF_UNSIGNED_BYTE:
+    return 1;
+  case GLTF_SHORT:
+  case GLTF_UNSIGNED_SHORT:
+    return 2;
+  case GLTF_UNSIGNED_INT:
+  case GLTF_FLOAT:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+inline uint32_t gltf_type_components(const std::string &type) {
+  if (type == "SCALAR") {
+    return 1;
+  }
+  if (type == "VEC2") {
+    return 2;
+  }
+  if (type == "VEC3") {
+    return 3;
+  }
+  if (type == "VEC4") {
+    return 4;
+  }
+  return 0;
+}
+
+inline uint32_t gltf_read_u32(const unsigned char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// component `c` of element `i` as a float, applying the normalization rules
+// of the glTF spec.
+inline float gltf_read_float(const GltfAccessor &a, size_t i, uint32_t c) {
+  const unsigned char *p =
+    a.data + i * a.stride + c * gltf_component_size(a.component_type);
+  switch (a.component_type) {
+  case GLTF_FLOAT: {
+    float v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  case GLTF_BYTE: {
+    int8_t v = (int8_t)*p;
+    return a.normalized ? glm::max(v / 127.0f, -1.0f) : (float)v;
+  }
+  case GLTF_UNSIGNED_BYTE:
+    return a.normalized ? *p / 255.0f : (float)*p;
+  case GLTF_SHORT: {
+    int16_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return a.normalized ? glm::max(v / 32767.0f, -1.0f) : (float)v;
+  }
+  case GLTF_UNSIGNED_SHORT: {
+    uint16_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return a.normalized ? v / 65535.0f : (float)v;
+  }
+  default:
+    return (float)gltf_read_u32(p);
+  }
+}
+
+inline uint32_t gltf_read_index(const GltfAccessor &a, size_t i) {
+  const unsigned char *p = a.data + i * a.stride;
+  switch (a.component_type) {
+  case GLTF_UNSIGNED_BYTE:
+    return *p;
+  case GLTF_UNSIGNED_SHORT: {
+    uint16_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  default:
+    return gltf_read_u32(p);
+  }
+}
+
+// `matrix`, or translation * rotation * scale.
+inline glm::mat4 gltf_node_matrix(const JsonValue &node) {
+  glm::mat4 m(1.0f);
+  const JsonValue *matrix = node.find("matrix");
+  if (matrix && matrix->is_array() && matrix->size() == 16) {
+    // column-major, like glm.
+    for (int i = 0; i < 16; i++) {
+      m[i / 4][i % 4] = (float)matrix->array[i].number;
+    }
+    return m;
+  }
+
+  auto component = [&](const char *key, size_t i, float fallback) {
+    const JsonValue *array = node.find(key);
+    const JsonValue *value = array ? array->at(i) : nullptr;
+    return value && value->is_number() ? (float)value->number : fallback;
+  };
+  float x = component("rotation", 0, 0.0f);
+  float y = component("rotation", 1, 0.0f);
+  float z = component("rotation", 2, 0.0f);
+  float w = component("rotation", 3, 1.0f);
+  glm::vec3 s(component("scale", 0, 1.0f), component("scale", 1, 1.0f),
+              component("scale", 2, 1.0f));
+  // rotation matrix of the unit quaternion, columns scaled.
+  m[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + z * w),
+                   2 * (x * z - y * w), 0.0f) *
+         s.x;
+  m[1] = glm::vec4(2 * (x * y - z * w), 1 - 2 * (x * x + z * z),
+                   2 * (y * z + x * w), 0.0f) *
+         s.y;
+  m[2] = glm::vec4(2 * (x * z + y * w), 2 * (y * z - x * w),
+                   1 - 2 * (x * x + y * y), 0.0f) *
+         s.z;
+  m[3] = glm::vec4(component("translation", 0, 0.0f),
+                   component("translation", 1, 0.0f),
+                   component("translation", 2, 0.0f), 1.0f);
+  return m;
+}
+
+// depth first, so parents precede their children in the graph. `visited`
+// breaks cycles in malformed files.
+inline void gltf_add_node(GltfScene &scene, int64_t index, uint32_t parent,
+                          std::vector<bool> &visited) {
+  const JsonValue *nodes = scene.json.find("nodes");
+  const JsonValue *node = nodes ? nodes->at(index) : nullptr;
+  if (!node || visited[index]) {
+    return;
+  }
+  visited[index] = true;
+
+  uint32_t graph_node = scene.graph.add_node(parent, gltf_node_matrix(*node));
+  const JsonValue *meshes = scene.json.find("meshes");
+  const JsonValue *mesh =
+    meshes ? meshes->at(node->index_or_none("mesh")) : nullptr;
+  const JsonValue *primitives = mesh ? mesh->find("primitives") : nullptr;
+  if (primitives) {
+    for (const JsonValue &primitive : primitives->array) {
+      if (primitive.number_or("mode", GLTF_TRIANGLES) == GLTF_TRIANGLES) {
+        scene.primitives.push_back({graph_node, &primitive});
+      }
+    }
+  }
+
+  const JsonValue *children = node->find("children");
+  if (children) {
+    for (const JsonValue &child : children->array) {
+      if (child.is_number()) {
+        gltf_add_node(scene, (int64_t)child.number, graph_node, visited);
+      }
+    }
+  }
+}
+
+} // namespace detail
+
+// accessor `index`, checked against its buffer view and the BIN chunk.
+// sparse accessors and accessors without a buffer view are not supported.
+inline bool gltf_accessor(const GltfScene &scene, int64_t index,
+                          GltfAccessor &out) {
+  using namespace detail;
+  const JsonValue *accessors = scene.json.find("accessors");
+  const JsonValue *accessor = accessors ? accessors->at(index) : nullptr;
+  const JsonValue *views = scene.json.find("bufferViews");
+  const JsonValue *view =
+    accessor && views ? views->at(accessor->index_or_none("bufferView"))
+                      : nullptr;
+  if (!view || accessor->find("sparse") || view->number_or("buffer", 0) != 0) {
+    return false;
+  }
+
+  out.component_type = (uint32_t)accessor->number_or("componentType", 0);
+  out.components = gltf_type_components(accessor->string_or_empty("type"));
+  out.normalized = false;
+  const JsonValue *normalized = accessor->find("normalized");
+  if (normalized && normalized->type == JsonValue::Type::BOOL) {
+    out.normalized = normalized->boolean;
+  }
+  size_t element = gltf_component_size(out.component_type) * out.components;
+  int64_t count = accessor->index_or_none("count");
+  if (element == 0 || count < 0) {
+    return false;
+  }
+  out.count = (size_t)count;
+
+  int64_t view_offset = view->index_or_none("byteOffset");
+  int64_t view_length = view->index_or_none("byteLength");
+  int64_t offset = accessor->index_or_none("byteOffset");
+  int64_t stride = view->index_or_none("byteStride");
+  view_offset = view_offset < 0 ? 0 : view_offset;
+  offset = offset < 0 ? 0 : offset;
+  out.stride = stride > 0 ? (size_t)stride : element;
+  if (view_length < 0 || out.stride < element ||
+      (uint64_t)view_offset + view_length > scene.bin_size) {
+    return false;
+  }
+  if (out.count > 0 &&
+      (uint64_t)offset + (out.count - 1) * out.stride + element >
+        (uint64_t)view_length) {
+    return false;
+  }
+  out.data = scene.bin + view_offset + offset;
+  return true;
+}
+
+// Maps `path` and reads its JSON chunk and node hierarchy. Call from a thread
+// that may block.
+inline bool load_glb(const std::string &path, GltfScene &scene) {
+  using namespace detail;
+  scene = GltfScene();
+  scene.file = std::make_shared<MappedFile>();
+  if (!scene.file->open(path) || scene.file->size() < 20) {
+    return false;
+  }
+  const unsigned char *data = scene.file->data();
+  size_t size = scene.file->size();
+  if (gltf_read_u32(data) != GLB_MAGIC || gltf_read_u32(data + 4) != 2 ||
+      gltf_read_u32(data + 8) > size) {
+    fprintf(stderr, "Not a glTF 2.0 binary: %s\n", path.c_str());
+    return false;
+  }
+  size = gltf_read_u32(data + 8);
+
+  uint32_t json_length = gltf_read_u32(data + 12);
+  if (gltf_read_u32(data + 16) != GLB_CHUNK_JSON ||
+      json_length > size - 20 ||
+      !parse_json(reinterpret_cast<const char *>(data + 20), json_length,
+                  scene.json) ||
+      !scene.json.is_object()) {
+    fprintf(stderr, "Malformed glTF JSON chunk: %s\n", path.c_str());
+    return false;
+  }
+
+  // chunks start 4-byte aligned, so floats in BIN can be read in place.
+  size_t bin_chunk = 20 + ((json_length + 3) & ~size_t(3));
+  if (bin_chunk + 8 <= size &&
+      gltf_read_u32(data + bin_chunk + 4) == GLB_CHUNK_BIN) {
+    uint32_t bin_length = gltf_read_u32(data + bin_chunk);
+    if (bin_length > size - bin_chunk - 8) {
+      fprintf(stderr, "Truncated glTF BIN chunk: %s\n", path.c_str());
+      return false;
+    }
+    scene.bin = data + bin_chunk + 8;
+    scene.bin_size = bin_length;
+  }
+
+  // roots of the default scene, or of all nodes if there is none.
+  const JsonValue *nodes = scene.json.find("nodes");
+  size_t node_count = nodes ? nodes->size() : 0;
+  std::vector<bool> visited(node_count, false);
+  const JsonValue *scenes = scene.json.find("scenes");
+  int64_t default_scene = scene.json.index_or_none("scene");
+  const JsonValue *root_scene =
+    scenes ? scenes->at(default_scene < 0 ? 0 : default_scene) : nullptr;
+  const JsonValue *roots = root_scene ? root_scene->find("nodes") : nullptr;
+  if (roots) {
+    for (const JsonValue &root : roots->array) {
+      if (root.is_number()) {
+        gltf_add_node(scene, (int64_t)root.number, SceneGraph::NO_PARENT,
+                      visited);
+      }
+    }
+  } else {
+    std::vector<bool> is_child(node_count, false);
+    for (size_t i = 0; i < node_count; i++) {
+      const JsonValue *children = nodes->array[i].find("children");
+      for (size_t c = 0; children && c < children->size(); c++) {
+        double child = children->array[c].number;
+        if (child >= 0 && child < node_count) {
+          is_child[(size_t)child] = true;
+        }
+      }
+    }
+    for (size_t i = 0; i < node_count; i++) {
+      if (!is_child[i]) {
+        gltf_add_node(scene, i, SceneGraph::NO_PARENT, visited);
+      }
+    }
+  }
+  if (scene.graph.empty()) {
+    scene.graph.add_node(SceneGraph::NO_PARENT, glm::mat4(1.0f));
+  }
+  return true;
+}
+
+// accessor index of attribute `name`, or -1.
+inline int64_t gltf_attribute(const GltfPrimitive &primitive,
+                              const char *name) {
+  const JsonValue *attributes = primitive.json->find("attributes");
+  return attributes ? attributes->index_or_none(name) : -1;
+}
+
+// True if the primitive's vertices can be uploaded as they are: float
+// position, normal and texture coordinates interleaved at Vertex's offsets
+// and stride.
+inline bool gltf_direct_vertices(const GltfScene &scene,
+                                 const GltfPrimitive &primitive,
+                                 const Vertex *&vertices, size_t &count) {
+  using namespace detail;
+  GltfAccessor position, normal, tex_coords;
+  if (!gltf_accessor(scene, gltf_attribute(primitive, "POSITION"), position) ||
+      !gltf_accessor(scene, gltf_attribute(primitive, "NORMAL"), normal) ||
+      !gltf_accessor(scene, gltf_attribute(primitive, "TEXCOORD_0"),
+                     tex_coords)) {
+    return false;
+  }
+  for (const GltfAccessor *a : {&position, &normal, &tex_coords}) {
+    if (a->component_type != GLTF_FLOAT || a->stride != sizeof(Vertex) ||
+        a->count != position.count) {
+      return false;
+    }
+  }
+  if (position.components != 3 || normal.components != 3 ||
+      tex_coords.components != 2 ||
+      normal.data != position.data + offsetof(Vertex, normal) ||
+      tex_coords.data != position.data + offsetof(Vertex, tex_coords) ||
+      (uintptr_t)position.data % alignof(Vertex) != 0) {
+    return false;
+  }
+  vertices = reinterpret_cast<const Vertex *>(position.data);
+  count = position.count;
+  return true;
+}
+
+// True if the primitive has tightly packed 16- or 32-bit indices, all below
+// `vertex_count`.
+inline bool gltf_direct_indices(const GltfScene &scene,
+                                const GltfPrimitive &primitive,
+                                size_t vertex_count, const void *&indices,
+                                size_t &count, uint32_t &index_size) {
+  using namespace detail;
+  GltfAccessor a;
+  if (!gltf_accessor(scene, primitive.json->index_or_none("indices"), a) ||
+      a.components != 1 ||
+      (a.component_type != GLTF_UNSIGNED_SHORT &&
+       a.component_type != GLTF_UNSIGNED_INT) ||
+      a.stride != gltf_component_size(a.component_type) ||
+      (uintptr_t)a.data % a.stride != 0) {
+    return false;
+  }
+  // out of range indices would make the GPU read past the mesh.
+  for (size_t i = 0; i < a.count; i++) {
+    if (gltf_read_index(a, i) >= vertex_count) {
+      return false;
+    }
+  }
+  indices = a.data;
+  count = a.count / 3 * 3;
+  index_size = a.stride;
+  return true;
+}
+
+// The primitive's indices widened to 32 bits; 0..vertex_count-1 if it has
+// none.
+inline bool gltf_read_indices(const GltfScene &scene,
+                              const GltfPrimitive &primitive,
+                              size_t vertex_count,
+                              std::vector<unsigned int> &out) {
+  int64_t index = primitive.json->index_or_none("indices");
+  if (index < 0) {
+    out.resize(vertex_count / 3 * 3);
+    for (size_t i = 0; i < out.size(); i++) {
+      out[i] = i;
+    }
+    return true;
+  }
+  GltfAccessor a;
+  if (!gltf_accessor(scene, index, a) || a.components != 1 ||
+      a.component_type == detail::GLTF_FLOAT) {
+    return false;
+  }
+  out.resize(a.count / 3 * 3);
+  for (size_t i = 0; i < out.size(); i++) {
+    out[i] = detail::gltf_read_index(a, i);
+    if (out[i] >= vertex_count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Converts a primitive of any supported layout. Missing normals are
+// generated, missing texture coordinates are zero.
+inline bool gltf_mesh_data(const GltfScene &scene,
+                           const GltfPrimitive &primitive, MeshData &data) {
+  GltfAccessor position, normal, tex_coords;
+  if (!gltf_accessor(scene, gltf_attribute(primitive, "POSITION"), position) ||
+      position.components != 3) {
+    return false;
+  }
+  bool has_normal =
+    gltf_accessor(scene, gltf_attribute(primitive, "NORMAL"), normal) &&
+    normal.components == 3 && normal.count == position.count;
+  bool has_tex_coords =
+    gltf_accessor(scene, gltf_attribute(primitive, "TEXCOORD_0"),
+                  tex_coords) &&
+    tex_coords.components == 2 && tex_coords.count == position.count;
+
+  data.vertices.resize(position.count);
+  for (size_t i = 0; i < position.count; i++) {
+    Vertex &v = data.vertices[i];
+    for (uint32_t c = 0; c < 3; c++) {
+      v.position[c] = detail::gltf_read_float(position, i, c);
+      v.normal[c] =
+        has_normal ? detail::gltf_read_float(normal, i, c) : 0.0f;
+    }
+    for (uint32_t c = 0; c < 2; c++) {
+      v.tex_coords[c] =
+        has_tex_coords ? detail::gltf_read_float(tex_coords, i, c) : 0.0f;
+    }
+  }
+  if (!gltf_read_indices(scene, primitive, position.count, data.indices)) {
+    return false;
+  }
+  if (!has_normal) {
+    data.compute_smooth_normals(std::vector<bool>(data.vertices.size(), true));
+  }
+  data.compute_bounds();
+  return true;
+}
+
+// image index of the base color texture of the primitive's material, or -1.
+inline int64_t gltf_base_color_image(const GltfScene &scene,
+                                     const GltfPrimitive &primitive) {
+  const JsonValue *materials = scene.json.find("materials");
+  const JsonValue *material =
+    materials ? materials->at(primitive.json->index_or_none("material"))
+              : nullptr;
+  const JsonValue *pbr =
+    material ? material->find("pbrMetallicRoughness") : nullptr;
+  const JsonValue *info = pbr ? pbr->find("baseColorTexture") : nullptr;
+  const JsonValue *textures = scene.json.find("textures");
+  const JsonValue *texture =
+    info && textures ? textures->at(info->index_or_none("index")) : nullptr;
+  return texture ? texture->index_or_none("source") : -1;
+}
+
+// texture registry key of image `image` of the GLB at `path`.
+inline std::string gltf_image_key(const std::string &path, int64_t image) {
+  return path + "#image" + std::to_string(image);
+}
+
+// Decodes image `image` on demand: from its buffer view in the mapped file,
+// or from a file relative to `directory`. Data URIs are not supported.
+inline std::function<Image()> gltf_image_decoder(const GltfScene &scene,
+                                                 int64_t image,
+                                                 const std::string &directory,
+                                                 const std::string &key) {
+  const JsonValue *images = scene.json.find("images");
+  const JsonValue *entry = images ? images->at(image) : nullptr;
+  if (!entry) {
+    return [] { return Image(); };
+  }
+
+  const std::string &uri = entry->string_or_empty("uri");
+  if (!uri.empty()) {
+    std::string path = directory + "/" + uri;
+    return [path] { return Image::load(path.c_str(), false); };
+  }
+
+  const JsonValue *views = scene.json.find("bufferViews");
+  const JsonValue *view =
+    views ? views->at(entry->index_or_none("bufferView")) : nullptr;
+  int64_t offset = view ? view->index_or_none("byteOffset") : -1;
+  int64_t length = view ? view->index_or_none("byteLength") : -1;
+  offset = offset < 0 ? 0 : offset;
+  if (length <= 0 || (uint64_t)offset + length > scene.bin_size) {
+    return [] { return Image(); };
+  }
+  std::shared_ptr<MappedFile> file = scene.file;
+  const unsigned char *bytes = scene.bin + offset;
+  return [file, bytes, length, key] {
+    ScopedTimer timer(key, "decode");
+    return Image::decode(bytes, (size_t)length, false);
+  };
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// 64-bit non-cryptographic hash (XXH64 construction). Used for cache keys, not
+// for anything security sensitive.
+class Hasher64 {
+public:
+  explicit Hasher64(uint64_t seed = 0) {
+    acc[0] = seed + P1 + P2;
+    acc[1] = seed + P2;
+    acc[2] = seed;
+    acc[3] = seed - P1;
+    this->seed = seed;
+  }
+
+  Hasher64 &update(const void *data, size_t size) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    total += size;
+
+    if (buffered + size < 32) {
+      std::memcpy(buffer + buffered, p, size);
+      buffered += size;
+      return *this;
+    }
+
+    if (buffered > 0) {
+      size_t fill = 32 - buffered;
+      std::memcpy(buffer + buffered, p, fill);
+      consume(buffer);
+      p += fill;
+      size -= fill;
+      buffered = 0;
+    }
+
+    while (size >= 32) {
+      consume(p);
+      p += 32;
+      size -= 32;
+    }
+
+    std::memcpy(buffer, p, size);
+    buffered = size;
+    return *this;
+  }
+
+  Hasher64 &update(const std::string &s) { return update(s.data(), s.size()); }
+
+  template <typename T> Hasher64 &update_value(const T &value) {
+    return update(&value, sizeof(value));
+  }
+
+  uint64_t digest() const {
+    uint64_t h;
+    if (total >= 32) {
+      h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) +
+          rotl(acc[3], 18);
+      for (uint64_t a : acc) {
+        h = (h ^ round(0, a)) * P1 + P4;
+      }
+    } else {
+      h = seed + P5;
+    }
+    h += total;
+
+    const unsigned char *p = buffer;
+    size_t n = buffered;
+    for (; n >= 8; p += 8, n -= 8) {
+      h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    }
+    if (n >= 4) {
+      h = rotl(h ^ (uint64_t(read32(p)) * P1), 23) * P2 + P3;
+      p += 4;
+      n -= 4;
+    }
+    for (; n > 0; p++, n--) {
+      h = rotl(h ^ (*p * P5), 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+  }
+
+private:
+  static constexpr uint64_t P1 = 11400714785074694791ULL;
+  static constexpr uint64_t P2 = 14029467366897019727ULL;
+  static constexpr uint64_t P3 = 1609587929392839161ULL;
+  static constexpr uint64_t P4 = 9650029242287828579ULL;
+  static constexpr uint64_t P5 = 2870177450012600261ULL;
+
+  uint64_t acc[4];
+  uint64_t seed;
+  uint64_t total = 0;
+  unsigned char buffer[32];
+  size_t buffered = 0;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+  static uint64_t round(uint64_t a, uint64_t input) {
+    return rotl(a + input * P2, 31) * P1;
+  }
+
+  static uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  void consume(const unsigned char *p) {
+    for (int i = 0; i < 4; i++) {
+      acc[i] = round(acc[i], read64(p + i * 8));
+    }
+  }
+};
+
+inline uint64_t hash64(const void *data, size_t size, uint64_t seed = 0) {
+  return Hasher64(seed).update(data, size).digest();
+}
+
+inline uint64_t hash64(const std::string &s, uint64_t seed = 0) {
+  return hash64(s.data(), s.size(), seed);
+}
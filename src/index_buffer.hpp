@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Index storage whose element width is chosen per mesh: 16 bits when every
+// vertex can be addressed with them, 32 bits otherwise. Draw calls take the
+// matching GL type from gl_type() and scale offsets by element_size().
+class IndexBuffer {
+public:
+  IndexBuffer() = default;
+
+  IndexBuffer(const std::vector<unsigned int> &indices, size_t vertex_count)
+    : count(indices.size()), element_size_(element_size_for(vertex_count)) {
+    bytes.resize(count * element_size_);
+    if (element_size_ == 2) {
+      uint16_t *out = reinterpret_cast<uint16_t *>(bytes.data());
+      for (size_t i = 0; i < count; i++) {
+        out[i] = (uint16_t)indices[i];
+      }
+    } else {
+      std::memcpy(bytes.data(), indices.data(), bytes.size());
+    }
+  }
+
+  // copies indices that are already `element_size` bytes wide.
+  IndexBuffer(const void *data, size_t count, uint32_t element_size)
+    : count(count), element_size_(element_size) {
+    const uint8_t *bytes_in = static_cast<const uint8_t *>(data);
+    bytes.assign(bytes_in, bytes_in + count * element_size);
+  }
+
+  // 16-bit indices reach vertices 0..65535. primitive restart is never
+  // enabled, so 0xffff is an ordinary index.
+  static uint32_t element_size_for(size_t vertex_count) {
+    return vertex_count <= 65536 ? 2 : 4;
+  }
+
+  static GLenum gl_type_for(uint32_t element_size) {
+    return element_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  uint32_t element_size() const { return element_size_; }
+  GLenum gl_type() const { return gl_type_for(element_size_); }
+  const void *data() const { return bytes.data(); }
+  size_t byte_size() const { return bytes.size(); }
+
+  unsigned int operator[](size_t i) const {
+    if (element_size_ == 2) {
+      return reinterpret_cast<const uint16_t *>(bytes.data())[i];
+    }
+    return reinterpret_cast<const uint32_t *>(bytes.data())[i];
+  }
+
+private:
+  std::vector<uint8_t> bytes;
+  size_t count = 0;
+  uint32_t element_size_ = 4;
+};
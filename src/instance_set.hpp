@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+// Placements of one Model drawn together: Model::draw() with a set issues a
+// single instanced draw per mesh for every instance instead of walking the
+// model once per placement.
+//
+// Transforms live on the host and are streamed each draw into a GL buffer
+// that holds just the instances passing the frustum test. basic.vert reads
+// them as a per-instance mat4 at attribute locations 3-6.
+class ModelInstanceSet {
+public:
+  // first of the four vec4 attribute locations holding the matrix.
+  static constexpr GLuint ATTRIBUTE = 3;
+
+  ModelInstanceSet() = default;
+
+  ~ModelInstanceSet() {
+    if (buffer != 0) {
+      glDeleteBuffers(1, &buffer);
+    }
+  }
+
+  ModelInstanceSet(const ModelInstanceSet &) = delete;
+  ModelInstanceSet &operator=(const ModelInstanceSet &) = delete;
+
+  // Returns the new instance's index.
+  size_t add(const glm::mat4 &transform) {
+    transforms.push_back(transform);
+    scales.push_back(max_scale(transform));
+    return transforms.size() - 1;
+  }
+
+  void set(size_t index, const glm::mat4 &transform) {
+    transforms[index] = transform;
+    scales[index] = max_scale(transform);
+  }
+
+  void clear() {
+    transforms.clear();
+    scales.clear();
+  }
+
+  size_t size() const { return transforms.size(); }
+  bool empty() const { return transforms.empty(); }
+  const glm::mat4 &transform(size_t index) const { return transforms[index]; }
+
+  // Uploads the instances whose copy of the sphere (center, radius), given
+  // in model space, intersects the frustum of `view_projection`. Returns how
+  // many were uploaded.
+  size_t upload(const glm::vec3 &center, float radius,
+                const glm::mat4 &view_projection) {
+    Frustum frustum = Frustum::from_matrix(view_projection);
+    visible.clear();
+    for (size_t i = 0; i < transforms.size(); i++) {
+      glm::vec3 world = glm::vec3(transforms[i] * glm::vec4(center, 1.0f));
+      if (frustum.intersects_sphere(world, radius * scales[i])) {
+        visible.push_back(transforms[i]);
+      }
+    }
+    if (visible.empty()) {
+      return 0;
+    }
+
+    if (buffer == 0) {
+      glGenBuffers(1, &buffer);
+    }
+    // orphaned every upload, so a draw still reading last frame's data never
+    // stalls this one.
+    size_t bytes = visible.size() * sizeof(glm::mat4);
+    capacity = std::max(capacity, bytes);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, visible.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return visible.size();
+  }
+
+  // Points the instance attributes of the bound VAO at the uploaded
+  // matrices.
+  void bind_attributes() const {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (GLuint column = 0; column < 4; column++) {
+      glEnableVertexAttribArray(ATTRIBUTE + column);
+      glVertexAttribPointer(ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE,
+                            sizeof(glm::mat4),
+                            (void *)(column * sizeof(glm::vec4)));
+      glVertexAttribDivisor(ATTRIBUTE + column, 1);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // Restores the bound VAO for non-instanced draws.
+  static void unbind_attributes() {
+    for (GLuint column = 0; column < 4; column++) {
+      glVertexAttribDivisor(ATTRIBUTE + column, 0);
+      glDisableVertexAttribArray(ATTRIBUTE + column);
+    }
+  }
+
+private:
+  std::vector<glm::mat4> transforms;
+  // largest axis scale of each transform, for the bounding sphere.
+  std::vector<float> scales;
+  // scratch: this frame's surviving transforms.
+  std::vector<glm::mat4> visible;
+  unsigned int buffer = 0;
+  size_t capacity = 0;
+
+  static float max_scale(const glm::mat4 &m) {
+    return glm::max(glm::length(glm::vec3(m[0])),
+                    glm::max(glm::length(glm::vec3(m[1])),
+                             glm::length(glm::vec3(m[2]))));
+  }
+};
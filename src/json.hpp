@@ -0,0 +1,317 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal JSON document model and parser, enough for glTF. Objects keep
+// their members in file order; lookups are linear, which is fine for the
+// handful of keys a glTF object has.
+struct JsonValue {
+  enum class Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+  Type type = Type::NUL;
+  bool boolean = false;
+  double number = 0.0;
+  std::string string;
+  std::vector<JsonValue> array;
+  std::vector<std::pair<std::string, JsonValue>> object;
+
+  bool is_object() const { return type == Type::OBJECT; }
+  bool is_array() const { return type == Type::ARRAY; }
+  bool is_number() const { return type == Type::NUMBER; }
+  bool is_string() const { return type == Type::STRING; }
+
+  // member `key` of an object, or nullptr.
+  const JsonValue *find(const char *key) const {
+    for (const auto &member : object) {
+      if (member.first == key) {
+        return &member.second;
+      }
+    }
+    return nullptr;
+  }
+
+  // element `i` of an array, or nullptr.
+  const JsonValue *at(size_t i) const {
+    return i < array.size() ? &array[i] : nullptr;
+  }
+
+  size_t size() const { return array.size(); }
+
+  // number member `key`, or `fallback` if it is missing or not a number.
+  double number_or(const char *key, double fallback) const {
+    const JsonValue *value = find(key);
+    return value && value->is_number() ? value->number : fallback;
+  }
+
+  // a non-negative integer member, or -1.
+  int64_t index_or_none(const char *key) const {
+    double n = number_or(key, -1.0);
+    return n >= 0.0 && n <= 9007199254740992.0 ? (int64_t)n : -1;
+  }
+
+  const std::string &string_or_empty(const char *key) const {
+    static const std::string empty;
+    const JsonValue *value = find(key);
+    return value && value->is_string() ? value->string : empty;
+  }
+};
+
+namespace detail {
+
+class JsonParser {
+public:
+  JsonParser(const char *p, const char *end): p(p), end(end) {}
+
+  bool parse(JsonValue &out) {
+    if (!value(out, 0)) {
+      return false;
+    }
+    skip_space();
+    return p == end;
+  }
+
+private:
+  // deeper documents are malformed for our purposes and would only risk the
+  // stack.
+  static constexpr int MAX_DEPTH = 64;
+
+  const char *p;
+  const char *end;
+
+  void skip_space() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+      p++;
+    }
+  }
+
+  bool literal(const char *word) {
+    size_t n = std::strlen(word);
+    if ((size_t)(end - p) < n || std::memcmp(p, word, n) != 0) {
+      return false;
+    }
+    p += n;
+    return true;
+  }
+
+  bool value(JsonValue &out, int depth) {
+    skip_space();
+    if (p == end || depth > MAX_DEPTH) {
+      return false;
+    }
+    switch (*p) {
+    case '{':
+      return parse_object(out, depth);
+    case '[':
+      return parse_array(out, depth);
+    case '"':
+      out.type = JsonValue::Type::STRING;
+      return parse_string(out.string);
+    case 't':
+      out.type = JsonValue::Type::BOOL;
+      out.boolean = true;
+      return literal("true");
+    case 'f':
+      out.type = JsonValue::Type::BOOL;
+      return literal("false");
+    case 'n':
+      return literal("null");
+    default:
+      return parse_number(out);
+    }
+  }
+
+  bool parse_object(JsonValue &out, int depth) {
+    out.type = JsonValue::Type::OBJECT;
+    p++;
+    skip_space();
+    if (p < end && *p == '}') {
+      p++;
+      return true;
+    }
+    for (;;) {
+      skip_space();
+      std::string key;
+      if (p == end || *p != '"' || !parse_string(key)) {
+        return false;
+      }
+      skip_space();
+      if (p == end || *p++ != ':') {
+        return false;
+      }
+      out.object.emplace_back(std::move(key), JsonValue());
+      if (!value(out.object.back().second, depth + 1)) {
+        return false;
+      }
+      skip_space();
+      if (p == end) {
+        return false;
+      }
+      if (*p == '}') {
+        p++;
+        return true;
+      }
+      if (*p++ != ',') {
+        return false;
+      }
+    }
+  }
+
+  bool parse_array(JsonValue &out, int depth) {
+    out.type = JsonValue::Type::ARRAY;
+    p++;
+    skip_space();
+    if (p < end && *p == ']') {
+      p++;
+      return true;
+    }
+    for (;;) {
+      out.array.emplace_back();
+      if (!value(out.array.back(), depth + 1)) {
+        return false;
+      }
+      skip_space();
+      if (p == end) {
+        return false;
+      }
+      if (*p == ']') {
+        p++;
+        return true;
+      }
+      if (*p++ != ',') {
+        return false;
+      }
+    }
+  }
+
+  bool parse_hex4(uint32_t &out) {
+    if (end - p < 4) {
+      return false;
+    }
+    out = 0;
+    for (int i = 0; i < 4; i++) {
+      char c = *p++;
+      out <<= 4;
+      if (c >= '0' && c <= '9') {
+        out |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        out |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        out |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static void put_utf8(std::string &out, uint32_t c) {
+    if (c < 0x80) {
+      out += (char)c;
+    } else if (c < 0x800) {
+      out += (char)(0xc0 | (c >> 6));
+      out += (char)(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+      out += (char)(0xe0 | (c >> 12));
+      out += (char)(0x80 | ((c >> 6) & 0x3f));
+      out += (char)(0x80 | (c & 0x3f));
+    } else {
+      out += (char)(0xf0 | (c >> 18));
+      out += (char)(0x80 | ((c >> 12) & 0x3f));
+      out += (char)(0x80 | ((c >> 6) & 0x3f));
+      out += (char)(0x80 | (c & 0x3f));
+    }
+  }
+
+  bool parse_string(std::string &out) {
+    p++;
+    for (;;) {
+      const char *run = p;
+      while (p < end && *p != '"' && *p != '\\') {
+        p++;
+      }
+      out.append(run, p);
+      if (p == end) {
+        return false;
+      }
+      if (*p++ == '"') {
+        return true;
+      }
+      if (p == end) {
+        return false;
+      }
+      char c = *p++;
+      switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        out += c;
+        break;
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'n':
+        out += '\n';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u': {
+        uint32_t code;
+        if (!parse_hex4(code)) {
+          return false;
+        }
+        // surrogate pair.
+        if (code >= 0xd800 && code < 0xdc00 && end - p >= 6 && p[0] == '\\' &&
+            p[1] == 'u') {
+          p += 2;
+          uint32_t low;
+          if (!parse_hex4(low) || low < 0xdc00 || low >= 0xe000) {
+            return false;
+          }
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        }
+        put_utf8(out, code);
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+  }
+
+  bool parse_number(JsonValue &out) {
+    const char *start = p;
+    while (p < end && *p != '\0' && std::strchr("+-0123456789.eE", *p)) {
+      p++;
+    }
+    if (p == start) {
+      return false;
+    }
+    // strtod needs a terminated string; numbers are short.
+    std::string text(start, p);
+    char *parsed;
+    out.type = JsonValue::Type::NUMBER;
+    out.number = std::strtod(text.c_str(), &parsed);
+    return parsed == text.c_str() + text.size();
+  }
+};
+
+} // namespace detail
+
+// Parses the UTF-8 document in [data, data + size). Returns false on
+// malformed input.
+inline bool parse_json(const char *data, size_t size, JsonValue &out) {
+  out = JsonValue();
+  return detail::JsonParser(data, data + size).parse(out);
+}
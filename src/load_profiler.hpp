@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Wall-clock time spent in each load phase, summed per asset. Phases that
+// run on several worker threads at once (e.g. per-mesh conversion) add up
+// the time of every thread, so they can exceed the asset's total. GL phases
+// only measure command submission; the driver may finish the work later.
+//
+// report() prints a table and, if LEARNGL_LOAD_REPORT names a file, writes
+// the same numbers there as JSON.
+class LoadProfiler {
+public:
+  // any thread.
+  void record(const std::string &asset, const char *phase, double seconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string key = asset + '\0' + phase;
+    auto [it, inserted] = index.emplace(key, rows.size());
+    if (inserted) {
+      rows.push_back({asset, phase, 0.0, 0});
+    }
+    Row &row = rows[it->second];
+    row.seconds += seconds;
+    row.count++;
+  }
+
+  void report() const {
+    std::vector<Row> sorted = grouped();
+    printf("Load times:\n");
+    printf("  %-44s %-14s %10s %6s\n", "asset", "phase", "ms", "count");
+    const std::string *last = nullptr;
+    for (const Row &row : sorted) {
+      const char *asset = last && *last == row.asset ? "" : row.asset.c_str();
+      printf("  %-44s %-14s %10.2f %6zu\n", asset, row.phase.c_str(),
+             row.seconds * 1000.0, row.count);
+      last = &row.asset;
+    }
+
+    const char *path = std::getenv("LEARNGL_LOAD_REPORT");
+    if (path && *path && !write_json(path, sorted)) {
+      fprintf(stderr, "Failed to write load report: %s\n", path);
+    }
+  }
+
+private:
+  struct Row {
+    std::string asset;
+    std::string phase;
+    double seconds;
+    size_t count;
+  };
+
+  std::vector<Row> rows;
+  std::unordered_map<std::string, size_t> index;
+  mutable std::mutex mutex;
+
+  // rows of the same asset next to each other, in order of first appearance.
+  std::vector<Row> grouped() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<std::string, size_t> order;
+    for (const Row &row : rows) {
+      order.emplace(row.asset, order.size());
+    }
+    std::vector<Row> sorted = rows;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&](const Row &a, const Row &b) {
+                       return order.at(a.asset) < order.at(b.asset);
+                     });
+    return sorted;
+  }
+
+  static std::string json_string(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += c;
+      } else if ((unsigned char)c < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        out += escaped;
+      } else {
+        out += c;
+      }
+    }
+    return out + "\"";
+  }
+
+  static bool write_json(const char *path, const std::vector<Row> &sorted) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+      return false;
+    }
+    fprintf(file, "{\n  \"assets\": [");
+    for (size_t i = 0; i < sorted.size(); i++) {
+      bool first = i == 0 || sorted[i - 1].asset != sorted[i].asset;
+      bool last =
+        i + 1 == sorted.size() || sorted[i + 1].asset != sorted[i].asset;
+      if (first) {
+        fprintf(file, "%s\n    {\"asset\": %s, \"phases\": [", i ? "," : "",
+                json_string(sorted[i].asset).c_str());
+      }
+      fprintf(file, "%s\n      {\"phase\": %s, \"ms\": %.3f, \"count\": %zu}",
+              first ? "" : ",", json_string(sorted[i].phase).c_str(),
+              sorted[i].seconds * 1000.0, sorted[i].count);
+      if (last) {
+        fprintf(file, "\n    ]}");
+      }
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+  }
+};
+
+inline LoadProfiler &load_profiler() {
+  static LoadProfiler profiler;
+  return profiler;
+}
+
+// Records the time between construction and destruction as `phase` of
+// `asset`.
+class ScopedTimer {
+public:
+  ScopedTimer(std::string asset, const char *phase)
+    : asset(std::move(asset)), phase(phase),
+      start(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    load_profiler().record(asset, phase, elapsed.count());
+  }
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  std::string asset;
+  const char *phase;
+  std::chrono::steady_clock::time_point start;
+};
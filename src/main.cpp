@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
@@ -11,6 +15,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "camera.hpp"
+#include "file_watcher.hpp"
 #include "model.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
@@ -55,7 +60,10 @@ void render_imgui_window(
   glm::vec3 &directional_diffuse, glm::vec3 &directional_specular,
   std::vector<glm::vec3> &point_light_positions,
   std::vector<glm::vec3> &point_light_colors, float &point_light_constant,
-  float &point_light_linear, float &point_light_quadratic) {
+  float &point_light_linear, float &point_light_quadratic, float &lod_bias,
+  bool &cluster_culling, int &backpack_instances, const DrawStats &draw_stats,
+  const std::vector<const Model *> &models, const RayHit &hover,
+  const RayHit &selected, double pick_ms) {
 
   ImGui::Begin("Scene Controls");
 
@@ -64,6 +72,7 @@ void render_imgui_window(
     ImGui::BulletText("WASD - Move camera");
     ImGui::BulletText("Mouse - Look around");
     ImGui::BulletText("ESC - Toggle camera/cursor");
+    ImGui::BulletText("Click - Select geometry (cursor mode)");
     ImGui::BulletText("Cmd+W - Close window");
   }
 
@@ -72,6 +81,72 @@ void render_imgui_window(
     ImGui::Text("Camera Position: (%.2f, %.2f, %.2f)", camera.position.x,
                 camera.position.y, camera.position.z);
     ImGui::Text("Camera Yaw: %.2f, Pitch: %.2f", camera.yaw, camera.pitch);
+    ImGui::Text("Draw Calls: %zu, Triangles: %zu", draw_stats.draw_calls,
+                draw_stats.triangles);
+    ImGui::Text("Meshes Culled: %zu, VAO Binds: %zu", draw_stats.meshes_culled,
+                draw_stats.vao_binds);
+    ImGui::Text("Clusters Culled: %zu / %zu", draw_stats.clusters_culled,
+                draw_stats.clusters);
+    ImGui::Text("Instances Drawn: %zu", draw_stats.instances);
+    for (const Model *model : models) {
+      MemoryUsage memory = model->memory_usage();
+      const std::string &path = model->source_path();
+      const double mib = 1024.0 * 1024.0;
+      ImGui::Text("%s: Host %.1f MiB, GPU %.1f / %.1f MiB",
+                  path.substr(path.find_last_of('/') + 1).c_str(),
+                  memory.host_bytes / mib, memory.gpu_bytes / mib,
+                  memory.gpu_allocated_bytes / mib);
+    }
+  }
+
+  if (ImGui::CollapsingHeader("Models", ImGuiTreeNodeFlags_DefaultOpen)) {
+    for (const Model *model : models) {
+      LoadProgress progress = model->progress();
+      float fraction =
+        progress.meshes_total
+          ? (float)progress.meshes_loaded / progress.meshes_total
+          : 0.0f;
+      char overlay[64];
+      if (progress.state == LoadState::FAILED) {
+        snprintf(overlay, sizeof(overlay), "failed");
+      } else if (progress.meshes_total == 0 &&
+                 progress.state == LoadState::LOADING) {
+        snprintf(overlay, sizeof(overlay), "importing");
+      } else {
+        snprintf(overlay, sizeof(overlay), "%zu / %zu meshes",
+                 progress.meshes_loaded, progress.meshes_total);
+      }
+      ImGui::Text("%s", model->source_path().c_str());
+      ImGui::ProgressBar(progress.state == LoadState::READY ? 1.0f : fraction,
+                         ImVec2(-1.0f, 0.0f), overlay);
+    }
+  }
+
+  if (ImGui::CollapsingHeader("Picking", ImGuiTreeNodeFlags_DefaultOpen)) {
+    ImGui::Text("Ray cast: %.3f ms", pick_ms);
+    for (const RayHit *hit : {&hover, &selected}) {
+      const char *label = hit == &hover ? "Hover" : "Selected";
+      if (!*hit) {
+        ImGui::Text("%s: -", label);
+        continue;
+      }
+      const std::string &path = hit->model->source_path();
+      ImGui::Text("%s: %s mesh %zu, triangle %u", label,
+                  path.substr(path.find_last_of('/') + 1).c_str(),
+                  hit->mesh_index, hit->triangle);
+      ImGui::Text("  at (%.2f, %.2f, %.2f)", hit->position.x,
+                  hit->position.y, hit->position.z);
+    }
+  }
+
+  if (ImGui::CollapsingHeader("Level of Detail",
+                              ImGuiTreeNodeFlags_DefaultOpen)) {
+    ImGui::SliderFloat("LOD Bias (px)", &lod_bias, 0.0f, 8.0f);
+    ImGui::Checkbox("Cluster Culling", &cluster_culling);
+  }
+
+  if (ImGui::CollapsingHeader("Instancing", ImGuiTreeNodeFlags_DefaultOpen)) {
+    ImGui::SliderInt("Backpacks", &backpack_instances, 0, 10000);
   }
 
   if (ImGui::CollapsingHeader("Directional Light",
@@ -171,6 +246,8 @@ int main() {
   int nr_attributes;
   glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &nr_attributes);
   printf("Maximum nr of vertex attributes supported: %d\n", nr_attributes);
+  // before any texture starts decoding.
+  texture_registry().detect_compression();
 
   Shader obj_shader = Shader("src/basic.vert", "src/basic.frag");
   // Shader obj_shader = Shader("src/basic.vert", "src/normal.frag");
@@ -303,9 +380,14 @@ int main() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
   }
 
-  Texture lamp_tex("./assets/redstone-lamp.png");
-  Texture container_tex("./assets/container2.png");
-  Texture container_specular_tex("./assets/container2-specular-map.png");
+  // decoded on the worker pool; placeholders until update() uploads them.
+  TextureRegistry &textures = texture_registry();
+  Texture lamp_tex =
+    textures.acquire("./assets/redstone-lamp.png", TextureType::DIFFUSE);
+  Texture container_tex =
+    textures.acquire("./assets/container2.png", TextureType::DIFFUSE);
+  Texture container_specular_tex = textures.acquire(
+    "./assets/container2-specular-map.png", TextureType::SPECULAR);
 
   // draw in wireframe polygons.
   // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -357,9 +439,44 @@ int main() {
   float spotlight_cutoff = 12.5f;
   float spotlight_outer_cutoff = 20.5f;
 
-  Model backpack_model("./assets/backpack/backpack.obj");
-  Model sponza_model("./assets/sponza/sponza.obj");
+  float lod_bias = 1.0f;
+  bool cluster_culling = true;
+  DrawStats draw_stats;
+
+  // the packed vertex format halves their geometry memory.
+  ModelOptions model_options;
+  model_options.vertex_format = VertexFormat::PACKED;
+  // held by pointer so they can be destroyed before the GL context is.
+  auto backpack_model = std::make_unique<Model>(
+    "./assets/backpack/backpack.obj", model_options);
+  auto sponza_model =
+    std::make_unique<Model>("./assets/sponza/sponza.obj", model_options);
   // Model sponza_model("./assets/sponza/modified.obj");
+  std::vector<const Model *> models = {backpack_model.get(),
+                                       sponza_model.get()};
+  bool load_reported = false;
+
+  glm::mat4 backpack_placement = glm::mat4(1.0f);
+  backpack_placement =
+    glm::translate(backpack_placement, glm::vec3(0.0f, 1.0f, 0.0f));
+  backpack_placement = glm::rotate(backpack_placement, glm::radians(-90.0f),
+                                   glm::vec3(0.0f, 1.0f, 0.0f));
+  backpack_placement = glm::scale(backpack_placement, glm::vec3(0.2f));
+  glm::mat4 sponza_placement = glm::mat4(1.0f);
+  sponza_placement = glm::scale(sponza_placement, glm::vec3(0.01f));
+
+  // extra backpacks in a square grid on the floor, drawn instanced.
+  int backpack_instances = 0;
+  auto backpack_grid = std::make_unique<ModelInstanceSet>();
+
+  // geometry under the cursor while it is free, and the last clicked.
+  RayHit hover, selected;
+  double pick_ms = 0.0;
+  bool mouse_was_down = false;
+
+  // edited assets are reloaded while running: textures in place, models by
+  // re-importing just that model.
+  FileWatcher asset_watcher("./assets");
 
   while (!glfwWindowShouldClose(window)) {
     if (glfwGetWindowAttrib(window, GLFW_ICONIFIED)) {
@@ -367,6 +484,72 @@ int main() {
       continue;
     }
 
+    for (const std::string &path : asset_watcher.poll()) {
+      bool used = texture_registry().reload(path);
+      for (Model *model : {backpack_model.get(), sponza_model.get()}) {
+        if (model->depends_on(path)) {
+          model->reload();
+          used = true;
+        }
+      }
+      if (used) {
+        printf("Reloading %s\n", path.c_str());
+      }
+    }
+    texture_registry().update();
+
+    // meshes that finished loading in the background since the last frame.
+    backpack_model->update();
+    sponza_model->update();
+    if (!load_reported &&
+        std::none_of(models.begin(), models.end(), [](const Model *model) {
+          return model->progress().state == LoadState::LOADING;
+        })) {
+      load_profiler().report();
+      load_reported = true;
+    }
+
+    // picking: a ray from the camera through the cursor, cast against every
+    // model's BVH.
+    hover = RayHit();
+    if (!camera_active && !ImGui::GetIO().WantCaptureMouse) {
+      double cursor_x, cursor_y;
+      int window_width, window_height;
+      glfwGetCursorPos(window, &cursor_x, &cursor_y);
+      glfwGetWindowSize(window, &window_width, &window_height);
+      glm::vec2 ndc(2.0f * cursor_x / window_width - 1.0f,
+                    1.0f - 2.0f * cursor_y / window_height);
+      glm::mat4 inverse_clip =
+        glm::inverse(camera.projection(ASPECT_RATIO) * camera.view());
+      glm::vec4 near = inverse_clip * glm::vec4(ndc, -1.0f, 1.0f);
+      glm::vec4 far = inverse_clip * glm::vec4(ndc, 1.0f, 1.0f);
+      // t runs from the near plane (0) to the far plane (1).
+      Ray ray;
+      ray.origin = glm::vec3(near) / near.w;
+      ray.direction = glm::vec3(far) / far.w - ray.origin;
+      ray.t_max = 1.0f;
+
+      auto pick_start = std::chrono::steady_clock::now();
+      backpack_model->raycast(ray, backpack_placement, hover);
+      sponza_model->raycast(ray, sponza_placement, hover);
+      pick_ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - pick_start)
+                  .count();
+
+      bool mouse_down =
+        glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+      if (mouse_down && !mouse_was_down) {
+        selected = hover;
+        if (selected) {
+          printf("Selected %s mesh %zu triangle %u at (%.3f, %.3f, %.3f)\n",
+                 selected.model->source_path().c_str(), selected.mesh_index,
+                 selected.triangle, selected.position.x, selected.position.y,
+                 selected.position.z);
+        }
+      }
+      mouse_was_down = mouse_down;
+    }
+
     // Start the ImGui frame
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -377,7 +560,8 @@ int main() {
       spotlight_ambient, spotlight_diffuse, spotlight_specular, directional_dir,
       directional_ambient, directional_diffuse, directional_specular,
       point_light_positions, point_light_colors, point_light_constant,
-      point_light_linear, point_light_quadratic);
+      point_light_linear, point_light_quadratic, lod_bias, cluster_culling,
+      backpack_instances, draw_stats, models, hover, selected, pick_ms);
 
     ImGui::Render();
 
@@ -394,6 +578,19 @@ int main() {
     glm::mat4 view = camera.view();
     glm::mat4 projection = camera.projection(ASPECT_RATIO);
 
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+
+    draw_stats = DrawStats();
+    DrawContext draw_ctx;
+    draw_ctx.view = view;
+    draw_ctx.projection = projection;
+    draw_ctx.viewport_height = (float)framebuffer_height;
+    draw_ctx.lod_bias = lod_bias;
+    draw_ctx.cluster_culling = cluster_culling;
+    draw_ctx.highlight = hover.mesh;
+    draw_ctx.stats = &draw_stats;
+
     // glm::vec3 rotation_point;
     // if (abs(rotation_axis.y) < abs(rotation_axis.x)) {
     //   rotation_point =
@@ -478,33 +675,30 @@ int main() {
 
       // backpack
       if (1) {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 1.0f, 0.0f));
-        model =
-          glm::rotate(model, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.2f));
-        obj_shader.set_mat4("model", model);
-
-        glm::mat3 normal_matrix =
-          glm::transpose(glm::inverse(glm::mat3(view * model)));
-        obj_shader.set_mat3("normalMatrix", normal_matrix);
-
-        backpack_model.draw(obj_shader);
+        // draw() sets the model and normal matrices per scene graph node.
+        draw_ctx.model = backpack_placement;
+        backpack_model->draw(obj_shader, draw_ctx);
+      }
+
+      if ((int)backpack_grid->size() != backpack_instances) {
+        backpack_grid->clear();
+        int side = (int)std::ceil(std::sqrt((float)backpack_instances));
+        const float spacing = 0.5f;
+        for (int i = 0; i < backpack_instances; i++) {
+          glm::vec3 offset((i % side - (side - 1) * 0.5f) * spacing, -0.8f,
+                           (i / side - (side - 1) * 0.5f) * spacing);
+          backpack_grid->add(glm::translate(glm::mat4(1.0f), offset) *
+                             backpack_placement);
+        }
+      }
+      if (!backpack_grid->empty()) {
+        backpack_model->draw(obj_shader, draw_ctx, *backpack_grid);
       }
 
       // sponza
       {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f));
-        model = glm::scale(model, glm::vec3(0.01f));
-        obj_shader.set_mat4("model", model);
-
-        glm::mat3 normal_matrix =
-          glm::transpose(glm::inverse(glm::mat3(view * model)));
-        obj_shader.set_mat3("normalMatrix", normal_matrix);
-
-        sponza_model.draw(obj_shader);
+        draw_ctx.model = sponza_placement;
+        sponza_model->draw(obj_shader, draw_ctx);
       }
     }
 
@@ -533,6 +727,11 @@ int main() {
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
+  // GL objects go while the context is still current.
+  backpack_grid.reset();
+  backpack_model.reset();
+  sponza_model.reset();
+  texture_registry().shutdown();
 
   // imgui cleanup
   ImGui_ImplOpenGL3_Shutdown();
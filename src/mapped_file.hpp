@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+  MappedFile() = default;
+  explicit MappedFile(const std::string &path) { open(path); }
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept
+    : ptr(std::exchange(other.ptr, nullptr)),
+      length(std::exchange(other.length, 0)) {}
+
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      close();
+      ptr = std::exchange(other.ptr, nullptr);
+      length = std::exchange(other.length, 0);
+    }
+    return *this;
+  }
+
+  bool open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file.
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+
+    ptr = static_cast<unsigned char *>(p);
+    length = st.st_size;
+    return true;
+  }
+
+  void close() {
+    if (ptr) {
+      munmap(ptr, length);
+      ptr = nullptr;
+      length = 0;
+    }
+  }
+
+  const unsigned char *data() const { return ptr; }
+  size_t size() const { return length; }
+  explicit operator bool() const { return ptr != nullptr; }
+
+private:
+  unsigned char *ptr = nullptr;
+  size_t length = 0;
+};
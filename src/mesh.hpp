@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -8,31 +12,247 @@
 
 #include <glad/glad.h>
 
+#include "bvh.hpp"
+#include "geometry_arena.hpp"
+#include "geometry_codec.hpp"
+#include "index_buffer.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
+#include "vertex_format.hpp"
 
-struct Vertex {
-  glm::vec3 position;
-  glm::vec3 normal;
-  glm::vec2 tex_coords;
+// What a mesh keeps of its geometry in host memory once it is on the GPU.
+// Anything that reads vertices back (the mesh cache writer, CPU queries)
+// needs KEEP or KEEP_COMPRESSED, or runs before the policy is applied.
+enum class GeometryRetention {
+  DISCARD,
+  KEEP,
+  // see geometry_codec.hpp; host_geometry() decodes on demand.
+  KEEP_COMPRESSED,
 };
 
+// material texture by path, resolved to a GL texture on the context thread.
+// an empty path stands for the generated default specular map.
+struct TextureRef {
+  TextureType type;
+  std::string path;
+};
+
+// one level of detail: a range of the mesh's index buffer. all levels share
+// the mesh's vertices. `error` is the object-space deviation from level 0.
+struct MeshLod {
+  uint32_t index_offset;
+  uint32_t index_count;
+  float error;
+};
+
+// cluster of up to 64 vertices / 124 triangles, a contiguous range of level
+// 0 indices. the normal cone (axis, cutoff = sine of its half angle) allows
+// culling clusters facing away from the camera.
+struct Meshlet {
+  uint32_t index_offset;
+  uint32_t index_count;
+  glm::vec3 center;
+  float radius;
+  glm::vec3 cone_axis;
+  float cone_cutoff;
+};
+
+// CPU-side result of importing one mesh. built on loader threads, turned into
+// a Mesh on the GL context thread.
+struct MeshData {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  std::vector<TextureRef> textures;
+  // LOD chain, finest first, packed back to back in `indices`.
+  std::vector<MeshLod> lods;
+  std::vector<Meshlet> meshlets;
+  glm::vec3 aabb_min = glm::vec3(0.0f);
+  glm::vec3 aabb_max = glm::vec3(0.0f);
+
+  // area-weighted vertex normals for the vertices flagged in `missing`.
+  void compute_smooth_normals(const std::vector<bool> &missing) {
+    std::vector<glm::vec3> accumulated(vertices.size(), glm::vec3(0.0f));
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      const glm::vec3 &a = vertices[indices[i]].position;
+      const glm::vec3 &b = vertices[indices[i + 1]].position;
+      const glm::vec3 &c = vertices[indices[i + 2]].position;
+      glm::vec3 n = glm::cross(b - a, c - a);
+      for (int k = 0; k < 3; k++) {
+        accumulated[indices[i + k]] += n;
+      }
+    }
+    for (size_t v = 0; v < vertices.size(); v++) {
+      float length = glm::length(accumulated[v]);
+      if (missing[v] && length > 0.0f) {
+        vertices[v].normal = accumulated[v] / length;
+      }
+    }
+  }
+
+  void compute_bounds() {
+    if (vertices.empty()) {
+      return;
+    }
+    aabb_min = aabb_max = vertices[0].position;
+    for (const Vertex &v : vertices) {
+      aabb_min = glm::min(aabb_min, v.position);
+      aabb_max = glm::max(aabb_max, v.position);
+    }
+  }
+};
+
+// A mesh's slice of its model's GeometryArena plus the material and
+// culling/LOD data needed to draw it.
 class Mesh {
 public:
+  // host copies of the geometry, empty once retain() has discarded or
+  // compressed them.
   std::vector<Vertex> vertices;
-  std::vector<unsigned int> indices;
+  IndexBuffer indices;
+  CompressedGeometry compressed;
   std::vector<Texture> textures;
+  std::vector<MeshLod> lods;
+  std::vector<Meshlet> meshlets;
+  glm::vec3 aabb_min = glm::vec3(0.0f);
+  glm::vec3 aabb_max = glm::vec3(0.0f);
+
+  // layout actually uploaded; PACKED requests fall back to FLOAT for meshes
+  // whose texture coordinates do not fit half floats.
+  VertexFormat vertex_format = VertexFormat::FLOAT;
+  // bytes per index on the GPU, 2 or 4.
+  uint32_t index_size = 4;
+  // arena VAO for vertex_format, bound by the caller before drawing.
+  unsigned int vao = 0;
+  GLint base_vertex = 0;
+  // byte offset of index 0 in the arena's index buffer.
+  size_t index_offset = 0;
+  // sizes of the uploaded geometry, whatever the host keeps.
+  size_t vertex_count = 0;
+  size_t index_count = 0;
+  // scene graph node whose world transform places the mesh.
+  uint32_t node = 0;
+  // level 0 triangles in mesh space; empty unless ModelOptions asked for it.
+  TriangleBvh triangle_bvh;
+
+  Mesh(GeometryArena &arena, MeshData &&data, std::vector<Texture> textures,
+       VertexFormat format = VertexFormat::FLOAT)
+    : vertices(std::move(data.vertices)),
+      indices(data.indices, vertices.size()), textures(std::move(textures)),
+      lods(std::move(data.lods)), meshlets(std::move(data.meshlets)),
+      aabb_min(data.aabb_min), aabb_max(data.aabb_max) {
+    setupMesh(arena, vertices.data(), vertices.size(), indices.data(),
+              indices.size(), indices.element_size(), format);
+  }
+
+  // uploads borrowed geometry without keeping a host copy; see
+  // copy_geometry().
+  Mesh(GeometryArena &arena, const Vertex *vertices, size_t vertex_count,
+       const void *indices, size_t index_count, uint32_t index_size,
+       std::vector<Texture> textures, std::vector<MeshLod> lods,
+       std::vector<Meshlet> meshlets, glm::vec3 aabb_min, glm::vec3 aabb_max,
+       VertexFormat format = VertexFormat::FLOAT)
+    : textures(std::move(textures)), lods(std::move(lods)),
+      meshlets(std::move(meshlets)), aabb_min(aabb_min), aabb_max(aabb_max) {
+    setupMesh(arena, vertices, vertex_count, indices, index_count, index_size,
+              format);
+  }
+
+  // takes a host copy of geometry uploaded through the borrowing
+  // constructor.
+  void copy_geometry(const Vertex *vertices, const void *indices,
+                     uint32_t index_size) {
+    this->vertices.assign(vertices, vertices + vertex_count);
+    this->indices = IndexBuffer(indices, index_count, index_size);
+  }
 
-  // fixme: how do i avoid copy.
-  Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
-       std::vector<Texture> textures) {
-    this->vertices = vertices;
-    this->indices = indices;
-    this->textures = textures;
-    setupMesh();
+  // drops or compresses the host copies. the GPU copy is unaffected.
+  void retain(GeometryRetention policy) {
+    if (policy == GeometryRetention::KEEP) {
+      return;
+    }
+    if (policy == GeometryRetention::KEEP_COMPRESSED && !vertices.empty()) {
+      compressed = compress_geometry(vertices, indices);
+    }
+    vertices = std::vector<Vertex>();
+    indices = IndexBuffer();
+  }
+
+  // the host geometry with 32-bit indices, decompressed if need be. false if
+  // it was discarded.
+  bool host_geometry(std::vector<Vertex> &out_vertices,
+                     std::vector<unsigned int> &out_indices) const {
+    if (!vertices.empty()) {
+      out_vertices = vertices;
+      out_indices.resize(indices.size());
+      for (size_t i = 0; i < indices.size(); i++) {
+        out_indices[i] = indices[i];
+      }
+      return true;
+    }
+    return !compressed.empty() &&
+           decompress_geometry(compressed, out_vertices, out_indices);
+  }
+
+  // host memory held by this mesh, metadata included.
+  size_t host_bytes() const {
+    return vertices.capacity() * sizeof(Vertex) + indices.byte_size() +
+           compressed.byte_size() + lods.capacity() * sizeof(MeshLod) +
+           meshlets.capacity() * sizeof(Meshlet) +
+           textures.capacity() * sizeof(Texture) + triangle_bvh.byte_size();
+  }
+
+  // this mesh's share of the arena buffers.
+  size_t gpu_bytes() const {
+    return vertex_count * GeometryArena::stride(vertex_format) +
+           index_count * index_size;
+  }
+
+  const MeshLod &lod(size_t level) const {
+    return lods[std::min(level, lods.size() - 1)];
+  }
+
+  GLenum index_type() const { return IndexBuffer::gl_type_for(index_size); }
+
+  // arena byte offset of index `i` of this mesh, as glDrawElements expects.
+  const void *index_pointer(size_t i) const {
+    return (const void *)(index_offset + i * index_size);
+  }
+
+  // expects `vao` to be bound.
+  void draw(Shader &shader, size_t level = 0) {
+    const MeshLod &range = lod(level);
+    bind(shader);
+    glDrawElementsBaseVertex(GL_TRIANGLES, range.index_count, index_type(),
+                             (void *)index_pointer(range.index_offset),
+                             base_vertex);
+  }
+
+  // draws `instances` copies in one call, each placed by the bound instance
+  // attributes; see ModelInstanceSet. expects `vao` to be bound.
+  void draw_instanced(Shader &shader, GLsizei instances, size_t level = 0) {
+    const MeshLod &range = lod(level);
+    bind(shader);
+    glDrawElementsInstancedBaseVertex(
+      GL_TRIANGLES, range.index_count, index_type(),
+      (void *)index_pointer(range.index_offset), instances, base_vertex);
+  }
+
+  // draws several index ranges in one call, e.g. the visible meshlets.
+  // `offsets` come from index_pointer(); expects `vao` to be bound.
+  void draw_ranges(Shader &shader, const std::vector<GLsizei> &counts,
+                   const std::vector<const void *> &offsets,
+                   const std::vector<GLint> &base_vertices) {
+    if (counts.empty()) {
+      return;
+    }
+    bind(shader);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), index_type(),
+                                  offsets.data(), counts.size(),
+                                  base_vertices.data());
   }
 
-  void draw(Shader &shader) {
+private:
+  void bind(Shader &shader) {
     shader.use();
     unsigned int diffuse_nr = 1;
     unsigned int specular_nr = 1;
@@ -54,43 +274,36 @@ public:
 
     // glActiveTexture(GL_TEXTURE0);
 
-    // draw mesh
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    bool packed = vertex_format == VertexFormat::PACKED;
+    shader.set_bool("packedVertex", packed);
+    if (packed) {
+      shader.set_vec3("positionOffset", aabb_min);
+      shader.set_vec3("positionScale",
+                      packed_position_scale(aabb_min, aabb_max));
+    }
   }
 
-private:
-  unsigned int VAO, VBO, EBO;
-
-  void setupMesh() {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                 vertices.data(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 indices.data(), GL_STATIC_DRAW);
-
-    // vertex positions
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-    // vertex normals
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, normal));
-    // vertex texture coords
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, tex_coords));
-
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  void setupMesh(GeometryArena &arena, const Vertex *vertices,
+                 size_t vertex_count, const void *indices, size_t index_count,
+                 uint32_t index_size, VertexFormat format) {
+    this->index_size = index_size;
+    this->vertex_count = vertex_count;
+    this->index_count = index_count;
+    // meshes built without a LOD chain draw everything as level 0.
+    if (lods.empty()) {
+      lods.push_back({0, (uint32_t)index_count, 0.0f});
+    }
+    vertex_format = resolve_vertex_format(format, vertices, vertex_count);
+
+    if (vertex_format == VertexFormat::PACKED) {
+      std::vector<PackedVertex> packed =
+        pack_vertices(vertices, vertex_count, aabb_min, aabb_max);
+      base_vertex =
+        arena.add_vertices(vertex_format, packed.data(), packed.size());
+    } else {
+      base_vertex = arena.add_vertices(vertex_format, vertices, vertex_count);
+    }
+    index_offset = arena.add_indices(indices, index_count, index_size);
+    vao = arena.vao(vertex_format);
   }
 };
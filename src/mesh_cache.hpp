@@ -0,0 +1,429 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+#include "geometry_codec.hpp"
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "rans.hpp"
+#include "scene_graph.hpp"
+#include "texture.hpp"
+
+// Binary cache of imported meshes, stored in the asset cache after the first
+// import under a key of the source bytes and import options. Layout (all
+// sections 4-byte aligned, native endianness):
+//
+//   MeshCacheHeader
+//   node_count x { uint32 parent, float local[16] }, parents first
+//   bvh_node_count x BvhNode, then mesh_count x uint32 (mesh BVH)
+//   mesh_count x {
+//     MeshCacheRecord
+//     texture_count x { uint32 type, uint32 path_length, path (padded) }
+//     lod_count x MeshLod
+//     meshlet_count x Meshlet
+//     raw: vertex_count x Vertex, then index_count x uint16 or uint32
+//       (index_size), padded to 4 bytes
+//     compressed: vertex stream, then index stream, each padded to 4 bytes
+//     bvh_node_count x BvhNode, then one uint32 per level 0 triangle
+//   }
+//
+// Geometry is in its upload order, already reordered by mesh_optimizer.hpp.
+// Meshes that compress well are stored compressed: geometry_codec.hpp's
+// byte-plane vertex filter and delta index coding, each followed by rANS
+// (rans.hpp). The rest stay raw, so a mapped cache hands them to
+// glBufferData without any conversion. Compressed meshes decode
+// independently of each other; see MeshCacheView::decode().
+
+constexpr char MESH_CACHE_MAGIC[8] = {'L', 'O', 'G', 'L', 'M', 'S', 'H', 0};
+// bump whenever the layout or the import pipeline output changes.
+constexpr uint32_t MESH_CACHE_VERSION = 9;
+// meshes are stored compressed when that saves at least 1/8 of their bytes.
+constexpr size_t MESH_CACHE_MIN_SAVING = 8;
+
+struct MeshCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t mesh_count;
+  // asset cache key the file was stored under.
+  uint64_t key;
+  uint32_t node_count;
+  // of the model's mesh BVH; 0 if there is none.
+  uint32_t bvh_node_count;
+};
+
+struct MeshCacheRecord {
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t texture_count;
+  uint32_t lod_count;
+  uint32_t meshlet_count;
+  uint32_t index_size;
+  uint32_t node;
+  // of the mesh's triangle BVH; 0 if there is none.
+  uint32_t bvh_node_count;
+  // unpadded sizes of the compressed streams; both 0 for raw geometry.
+  uint32_t vertex_stream_bytes;
+  uint32_t index_stream_bytes;
+  float aabb_min[3];
+  float aabb_max[3];
+};
+
+static_assert(sizeof(Vertex) == 32,
+              "mesh cache assumes a tightly packed Vertex");
+static_assert(sizeof(MeshLod) == 12, "mesh cache assumes a packed MeshLod");
+static_assert(sizeof(Meshlet) == 40, "mesh cache assumes a packed Meshlet");
+static_assert(sizeof(glm::mat4) == 64, "mesh cache assumes a packed mat4");
+static_assert(sizeof(BvhNode) == 32, "mesh cache assumes a packed BvhNode");
+
+// Views into a mapped cache file. Only valid while the reader is alive.
+//
+// vertices and indices are set by decode(): they point into the file for raw
+// meshes and at the decoded copies otherwise.
+struct MeshCacheView {
+  const Vertex *vertices;
+  uint32_t vertex_count;
+  const void *indices;
+  uint32_t index_count;
+  uint32_t index_size;
+  uint32_t node;
+  std::vector<TextureRef> textures;
+  std::vector<MeshLod> lods;
+  std::vector<Meshlet> meshlets;
+  glm::vec3 aabb_min;
+  glm::vec3 aabb_max;
+  // rebuilt from the stored tree by decode(); owns its data.
+  TriangleBvh triangle_bvh;
+
+  // geometry as stored: raw data or the two compressed streams.
+  const uint8_t *vertex_data;
+  uint32_t vertex_stream_bytes;
+  const uint8_t *index_data;
+  uint32_t index_stream_bytes;
+  std::vector<Vertex> decoded_vertices;
+  std::vector<uint8_t> decoded_indices;
+  // the stored triangle BVH, moved into triangle_bvh by decode().
+  Bvh stored_bvh;
+
+  bool compressed() const { return vertex_stream_bytes != 0; }
+
+  // Makes vertices and indices usable and assembles triangle_bvh. Touches
+  // nothing but this view, so views decode in parallel. False on corrupt
+  // streams.
+  bool decode() {
+    if (!compressed()) {
+      vertices = reinterpret_cast<const Vertex *>(vertex_data);
+      indices = index_data;
+    } else {
+      std::vector<uint8_t> stream;
+      decoded_vertices.resize(vertex_count);
+      decoded_indices.resize((size_t)index_count * index_size);
+      if (!rans_decode(vertex_data, vertex_stream_bytes, stream) ||
+          !decode_vertices(stream.data(), stream.size(), vertex_count,
+                           decoded_vertices.data()) ||
+          !rans_decode(index_data, index_stream_bytes, stream) ||
+          !decode_indices(stream.data(), stream.size(), index_count,
+                          index_size, decoded_indices.data())) {
+        return false;
+      }
+      vertices = decoded_vertices.data();
+      indices = decoded_indices.data();
+    }
+
+    triangle_bvh = TriangleBvh();
+    if (stored_bvh.empty()) {
+      return true;
+    }
+    const MeshLod &level0 = lods[0];
+    const uint8_t *level0_indices =
+      (const uint8_t *)indices + level0.index_offset * index_size;
+    return TriangleBvh::assemble(std::move(stored_bvh), vertices,
+                                 vertex_count, level0_indices,
+                                 level0.index_count, index_size,
+                                 triangle_bvh);
+  }
+};
+
+class MeshCacheReader {
+public:
+  // Maps the cache stored under `key`. Returns false if it is missing or
+  // malformed.
+  bool open(const std::string &cache_path, uint64_t key) {
+    if (!file.open(cache_path) || file.size() < sizeof(MeshCacheHeader)) {
+      return false;
+    }
+
+    MeshCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) ||
+        header.version != MESH_CACHE_VERSION || header.key != key) {
+      file.close();
+      return false;
+    }
+
+    remaining = header.mesh_count;
+    cursor = sizeof(MeshCacheHeader);
+    if (!read_nodes(header.node_count) ||
+        !read_bvh(header.bvh_node_count, header.mesh_count, bvh)) {
+      file.close();
+      return false;
+    }
+    return true;
+  }
+
+  size_t meshes_left() const { return remaining; }
+
+  // the model's node hierarchy, read by open().
+  const SceneGraph &scene_graph() const { return graph; }
+
+  // the model's BVH over its meshes, read by open(); may be empty.
+  const Bvh &mesh_bvh() const { return bvh; }
+
+  // Reads the next mesh. Returns false at the end or on a truncated file.
+  bool next(MeshCacheView &view) {
+    if (remaining == 0) {
+      return false;
+    }
+
+    MeshCacheRecord record;
+    if (!read(&record, sizeof(record))) {
+      return false;
+    }
+
+    view.textures.clear();
+    for (uint32_t i = 0; i < record.texture_count; i++) {
+      uint32_t type, length;
+      if (!read(&type, sizeof(type)) || !read(&length, sizeof(length)) ||
+          !has(length)) {
+        return false;
+      }
+      const char *chars = reinterpret_cast<const char *>(file.data() + cursor);
+      view.textures.push_back({(TextureType)type, std::string(chars, length)});
+      cursor += align4(length);
+    }
+
+    view.lods.resize(record.lod_count);
+    if (!read(view.lods.data(), record.lod_count * sizeof(MeshLod))) {
+      return false;
+    }
+    view.meshlets.resize(record.meshlet_count);
+    if (!read(view.meshlets.data(), record.meshlet_count * sizeof(Meshlet))) {
+      return false;
+    }
+
+    if ((record.index_size != 2 && record.index_size != 4) ||
+        (record.vertex_stream_bytes == 0) !=
+          (record.index_stream_bytes == 0)) {
+      return false;
+    }
+    view.vertex_stream_bytes = record.vertex_stream_bytes;
+    view.index_stream_bytes = record.index_stream_bytes;
+    size_t vertex_bytes = (size_t)record.vertex_count * sizeof(Vertex);
+    size_t index_bytes = (size_t)record.index_count * record.index_size;
+    if (view.compressed()) {
+      vertex_bytes = record.vertex_stream_bytes;
+      index_bytes = record.index_stream_bytes;
+    }
+    vertex_bytes = align4(vertex_bytes);
+    index_bytes = align4(index_bytes);
+    if (!has(vertex_bytes + index_bytes)) {
+      return false;
+    }
+    // decode() sets the vertex and index pointers.
+    view.vertices = nullptr;
+    view.indices = nullptr;
+    view.vertex_data = file.data() + cursor;
+    view.vertex_count = record.vertex_count;
+    cursor += vertex_bytes;
+    view.index_data = file.data() + cursor;
+    view.index_count = record.index_count;
+    view.index_size = record.index_size;
+    cursor += index_bytes;
+    if (record.node >= graph.size()) {
+      return false;
+    }
+    view.node = record.node;
+    for (const MeshLod &lod : view.lods) {
+      if ((uint64_t)lod.index_offset + lod.index_count > record.index_count) {
+        return false;
+      }
+    }
+    for (const Meshlet &meshlet : view.meshlets) {
+      if ((uint64_t)meshlet.index_offset + meshlet.index_count >
+          record.index_count) {
+        return false;
+      }
+    }
+
+    view.stored_bvh = Bvh();
+    if (record.bvh_node_count > 0 &&
+        (view.lods.empty() ||
+         !read_bvh(record.bvh_node_count, view.lods[0].index_count / 3,
+                   view.stored_bvh))) {
+      return false;
+    }
+
+    view.aabb_min = glm::vec3(record.aabb_min[0], record.aabb_min[1],
+                              record.aabb_min[2]);
+    view.aabb_max = glm::vec3(record.aabb_max[0], record.aabb_max[1],
+                              record.aabb_max[2]);
+
+    remaining--;
+    return true;
+  }
+
+private:
+  MappedFile file;
+  size_t cursor = 0;
+  size_t remaining = 0;
+  SceneGraph graph;
+  Bvh bvh;
+
+  // `node_count` nodes, then the primitive order if there are any nodes.
+  bool read_bvh(uint32_t node_count, size_t primitive_count, Bvh &out) {
+    out = Bvh();
+    if (node_count == 0) {
+      return true;
+    }
+    out.nodes.resize(node_count);
+    out.primitives.resize(primitive_count);
+    return read(out.nodes.data(), node_count * sizeof(BvhNode)) &&
+           read(out.primitives.data(), primitive_count * sizeof(uint32_t)) &&
+           out.valid(primitive_count);
+  }
+
+  bool read_nodes(uint32_t count) {
+    graph = SceneGraph();
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t parent;
+      glm::mat4 local;
+      if (!read(&parent, sizeof(parent)) || !read(&local, sizeof(local)) ||
+          (parent != SceneGraph::NO_PARENT && parent >= i)) {
+        return false;
+      }
+      graph.add_node(parent, local);
+    }
+    return true;
+  }
+
+  static size_t align4(size_t n) { return (n + 3) & ~size_t(3); }
+
+  bool has(size_t n) const { return cursor + n <= file.size(); }
+
+  bool read(void *dst, size_t n) {
+    if (!has(n)) {
+      return false;
+    }
+    std::memcpy(dst, file.data() + cursor, n);
+    cursor += n;
+    return true;
+  }
+};
+
+// Writes the cache for `key` to `path`; AssetCache::store() moves it into
+// place once it is complete.
+inline bool write_mesh_cache(const std::string &path, uint64_t key,
+                             const std::vector<Mesh> &meshes,
+                             const SceneGraph &graph, const Bvh &mesh_bvh) {
+  MeshCacheHeader header = {};
+  std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+  header.version = MESH_CACHE_VERSION;
+  header.mesh_count = meshes.size();
+  header.node_count = graph.size();
+  header.bvh_node_count = mesh_bvh.nodes.size();
+  header.key = key;
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return false;
+  }
+
+  const char zeros[4] = {};
+  auto write_bvh = [&](const Bvh &bvh) {
+    if (bvh.empty()) {
+      return;
+    }
+    out.write(reinterpret_cast<const char *>(bvh.nodes.data()),
+              bvh.nodes.size() * sizeof(BvhNode));
+    out.write(reinterpret_cast<const char *>(bvh.primitives.data()),
+              bvh.primitives.size() * sizeof(uint32_t));
+  };
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (uint32_t node = 0; node < graph.size(); node++) {
+    uint32_t parent = graph.parent(node);
+    out.write(reinterpret_cast<const char *>(&parent), sizeof(parent));
+    out.write(reinterpret_cast<const char *>(&graph.local(node)),
+              sizeof(glm::mat4));
+  }
+  write_bvh(mesh_bvh);
+  for (const Mesh &mesh : meshes) {
+    MeshCacheRecord record = {};
+    record.vertex_count = mesh.vertices.size();
+    record.index_count = mesh.indices.size();
+    record.texture_count = mesh.textures.size();
+    record.lod_count = mesh.lods.size();
+    record.meshlet_count = mesh.meshlets.size();
+    record.index_size = mesh.indices.element_size();
+    record.node = mesh.node;
+    record.bvh_node_count = mesh.triangle_bvh.bvh.nodes.size();
+
+    size_t raw_bytes = mesh.vertices.size() * sizeof(Vertex) +
+                       mesh.indices.byte_size();
+    std::vector<uint8_t> filtered, vertex_stream, index_stream;
+    encode_vertices(mesh.vertices.data(), mesh.vertices.size(), filtered);
+    rans_encode(filtered.data(), filtered.size(), vertex_stream);
+    filtered.clear();
+    encode_indices(mesh.indices, filtered);
+    rans_encode(filtered.data(), filtered.size(), index_stream);
+    bool compress = vertex_stream.size() + index_stream.size() <=
+                    raw_bytes - raw_bytes / MESH_CACHE_MIN_SAVING;
+    if (compress) {
+      record.vertex_stream_bytes = vertex_stream.size();
+      record.index_stream_bytes = index_stream.size();
+    }
+    for (int k = 0; k < 3; k++) {
+      record.aabb_min[k] = mesh.aabb_min[k];
+      record.aabb_max[k] = mesh.aabb_max[k];
+    }
+    out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+
+    for (const Texture &texture : mesh.textures) {
+      uint32_t type = (uint32_t)texture.type;
+      uint32_t length = texture.path.size();
+      out.write(reinterpret_cast<const char *>(&type), sizeof(type));
+      out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+      out.write(texture.path.data(), length);
+      out.write(zeros, (4 - length % 4) % 4);
+    }
+    out.write(reinterpret_cast<const char *>(mesh.lods.data()),
+              mesh.lods.size() * sizeof(MeshLod));
+    out.write(reinterpret_cast<const char *>(mesh.meshlets.data()),
+              mesh.meshlets.size() * sizeof(Meshlet));
+
+    if (compress) {
+      for (const std::vector<uint8_t> *stream :
+           {&vertex_stream, &index_stream}) {
+        out.write(reinterpret_cast<const char *>(stream->data()),
+                  stream->size());
+        out.write(zeros, (4 - stream->size() % 4) % 4);
+      }
+    } else {
+      out.write(reinterpret_cast<const char *>(mesh.vertices.data()),
+                mesh.vertices.size() * sizeof(Vertex));
+      out.write(reinterpret_cast<const char *>(mesh.indices.data()),
+                mesh.indices.byte_size());
+      out.write(zeros, (4 - mesh.indices.byte_size() % 4) % 4);
+    }
+    write_bvh(mesh.triangle_bvh.bvh);
+  }
+
+  out.close();
+  return (bool)out;
+}
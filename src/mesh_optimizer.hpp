@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+
+// Import-time index/vertex reordering for triangle lists.
+//
+//   optimize_vertex_cache  - triangle order for post-transform cache reuse
+//                            (Forsyth's linear-speed greedy ordering).
+//   optimize_overdraw      - reorders cache-friendly clusters of triangles so
+//                            that outward-facing clusters come first
+//                            (Sander et al., "Fast triangle reordering").
+//   optimize_vertex_fetch  - vertex buffer order matching first use.
+
+struct VertexCacheStats {
+  float acmr = 0.0f; // transformed vertices per triangle, 0.5 is ideal
+  float atvr = 0.0f; // transformed vertices per vertex, 1.0 is ideal
+};
+
+// Simulates a FIFO post-transform cache of `cache_size` entries.
+inline VertexCacheStats
+analyze_vertex_cache(const std::vector<unsigned int> &indices,
+                     size_t vertex_count, unsigned int cache_size = 16) {
+  VertexCacheStats stats;
+  if (indices.empty() || vertex_count == 0) {
+    return stats;
+  }
+
+  // a vertex is in the cache iff fewer than `cache_size` misses happened
+  // since it was inserted. stamps are 1-based, 0 means never inserted.
+  std::vector<size_t> inserted_at(vertex_count, 0);
+  std::vector<bool> used(vertex_count, false);
+  size_t misses = 0;
+  size_t unique = 0;
+  for (unsigned int index : indices) {
+    if (!used[index]) {
+      used[index] = true;
+      unique++;
+    }
+    if (inserted_at[index] == 0 || misses - inserted_at[index] >= cache_size) {
+      inserted_at[index] = ++misses;
+    }
+  }
+
+  stats.acmr = (float)misses / (indices.size() / 3);
+  stats.atvr = (float)misses / unique;
+  return stats;
+}
+
+namespace detail {
+
+constexpr int FORSYTH_CACHE_SIZE = 32;
+
+inline float forsyth_score(int cache_position, unsigned int live_triangles) {
+  if (live_triangles == 0) {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    // the last triangle's vertices get a fixed score so the next triangle
+    // does not simply reuse the most recent edge.
+    if (cache_position < 3) {
+      score = 0.75f;
+    } else {
+      float t = 1.0f - (float)(cache_position - 3) / (FORSYTH_CACHE_SIZE - 3);
+      score = std::pow(t, 1.5f);
+    }
+  }
+  // favour vertices with few triangles left so they are retired early.
+  return score + 2.0f / std::sqrt((float)live_triangles);
+}
+
+} // namespace detail
+
+inline void optimize_vertex_cache(std::vector<unsigned int> &indices,
+                                  size_t vertex_count) {
+  using detail::FORSYTH_CACHE_SIZE;
+  size_t n_triangles = indices.size() / 3;
+  if (n_triangles == 0) {
+    return;
+  }
+
+  // vertex -> triangles adjacency in CSR form.
+  std::vector<unsigned int> live(vertex_count, 0);
+  for (unsigned int index : indices) {
+    live[index]++;
+  }
+  std::vector<unsigned int> offsets(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; v++) {
+    offsets[v + 1] = offsets[v] + live[v];
+  }
+  std::vector<unsigned int> adjacency(indices.size());
+  std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t t = 0; t < n_triangles; t++) {
+    for (int k = 0; k < 3; k++) {
+      adjacency[fill[indices[t * 3 + k]]++] = t;
+    }
+  }
+
+  std::vector<float> vertex_score(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++) {
+    vertex_score[v] = detail::forsyth_score(-1, live[v]);
+  }
+  std::vector<float> triangle_score(n_triangles);
+  for (size_t t = 0; t < n_triangles; t++) {
+    triangle_score[t] = vertex_score[indices[t * 3]] +
+                        vertex_score[indices[t * 3 + 1]] +
+                        vertex_score[indices[t * 3 + 2]];
+  }
+
+  std::vector<bool> emitted(n_triangles, false);
+  std::vector<unsigned int> result;
+  result.reserve(indices.size());
+
+  // LRU cache; three extra slots hold vertices pushed out by the last insert
+  // so their scores get updated.
+  std::vector<unsigned int> cache, next_cache;
+  cache.reserve(FORSYTH_CACHE_SIZE + 3);
+  next_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+  size_t scan = 0; // fallback cursor for when the cache has no candidates
+  long best = 0;
+  for (size_t emitted_count = 0; emitted_count < n_triangles;
+       emitted_count++) {
+    if (best < 0) {
+      while (emitted[scan]) {
+        scan++;
+      }
+      best = scan;
+    }
+
+    const unsigned int *tri = &indices[best * 3];
+    result.insert(result.end(), tri, tri + 3);
+    emitted[best] = true;
+
+    // move the triangle's vertices to the front of the cache.
+    next_cache.assign(tri, tri + 3);
+    for (unsigned int v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2]) {
+        next_cache.push_back(v);
+      }
+    }
+    std::swap(cache, next_cache);
+
+    // retire the triangle from its vertices' live lists.
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = tri[k];
+      unsigned int *begin = &adjacency[offsets[v]];
+      unsigned int *end = begin + live[v];
+      *std::find(begin, end, (unsigned int)best) = *(end - 1);
+      live[v]--;
+    }
+
+    // rescore cached vertices and their triangles, pick the best candidate.
+    best = -1;
+    float best_score = -1.0f;
+    for (size_t i = 0; i < cache.size(); i++) {
+      unsigned int v = cache[i];
+      int position = i < (size_t)FORSYTH_CACHE_SIZE ? (int)i : -1;
+      float score = detail::forsyth_score(position, live[v]);
+      float delta = score - vertex_score[v];
+      vertex_score[v] = score;
+
+      for (unsigned int j = offsets[v]; j < offsets[v] + live[v]; j++) {
+        unsigned int t = adjacency[j];
+        triangle_score[t] += delta;
+        if (triangle_score[t] > best_score) {
+          best_score = triangle_score[t];
+          best = t;
+        }
+      }
+    }
+    if (cache.size() > (size_t)FORSYTH_CACHE_SIZE) {
+      cache.resize(FORSYTH_CACHE_SIZE);
+    }
+  }
+
+  indices.swap(result);
+}
+
+// Expects indices already optimized for the vertex cache. Splits them into
+// clusters at points where a FIFO cache of `cache_size` would restart, then
+// sorts the clusters so those facing away from the mesh centre are drawn
+// first. `threshold` bounds how much ACMR may be sacrificed (1.05 = 5%) by
+// allowing extra cluster boundaries.
+inline void optimize_overdraw(std::vector<unsigned int> &indices,
+                              const std::vector<Vertex> &vertices,
+                              unsigned int cache_size = 16,
+                              float threshold = 1.05f) {
+  size_t n_triangles = indices.size() / 3;
+  if (n_triangles < 2) {
+    return;
+  }
+
+  // hard boundaries: triangles whose three vertices all miss the cache.
+  std::vector<size_t> inserted_at(vertices.size(), 0);
+  std::vector<unsigned int> triangle_misses(n_triangles, 0);
+  size_t misses = 0;
+  for (size_t t = 0; t < n_triangles; t++) {
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[t * 3 + k];
+      if (inserted_at[v] == 0 || misses - inserted_at[v] >= cache_size) {
+        inserted_at[v] = ++misses;
+        triangle_misses[t]++;
+      }
+    }
+  }
+  float mesh_acmr = (float)misses / n_triangles;
+
+  // soft boundaries wherever the current cluster, simulated with a cache
+  // that starts cold at the cluster start, has an ACMR within the threshold
+  // of the whole mesh. the cold start keeps clusters from getting tiny.
+  std::vector<size_t> clusters;
+  std::fill(inserted_at.begin(), inserted_at.end(), 0);
+  size_t clock = 0;
+  size_t cluster_clock = 0;
+  size_t cluster_start = 0;
+  for (size_t t = 0; t < n_triangles; t++) {
+    bool hard = t > 0 && triangle_misses[t] == 3;
+    bool soft = t > cluster_start &&
+                (float)(clock - cluster_clock) / (t - cluster_start) <=
+                  mesh_acmr * threshold;
+    if (t == 0 || hard || soft) {
+      clusters.push_back(t);
+      cluster_start = t;
+      cluster_clock = clock;
+    }
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[t * 3 + k];
+      if (inserted_at[v] <= cluster_clock ||
+          clock - inserted_at[v] >= cache_size) {
+        inserted_at[v] = ++clock;
+      }
+    }
+  }
+  clusters.push_back(n_triangles);
+  size_t n_clusters = clusters.size() - 1;
+  if (n_clusters < 2) {
+    return;
+  }
+
+  // area-weighted centroid and normal per cluster.
+  glm::vec3 mesh_centroid(0.0f);
+  float mesh_area = 0.0f;
+  std::vector<glm::vec3> centroids(n_clusters), normals(n_clusters);
+  for (size_t c = 0; c < n_clusters; c++) {
+    glm::vec3 centroid(0.0f), normal(0.0f);
+    float area = 0.0f;
+    for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+      const glm::vec3 &a = vertices[indices[t * 3]].position;
+      const glm::vec3 &b = vertices[indices[t * 3 + 1]].position;
+      const glm::vec3 &d = vertices[indices[t * 3 + 2]].position;
+      glm::vec3 n = glm::cross(b - a, d - a);
+      float w = glm::length(n);
+      centroid += (a + b + d) * (w / 3.0f);
+      normal += n;
+      area += w;
+    }
+    mesh_centroid += centroid;
+    mesh_area += area;
+    centroids[c] = area > 0.0f ? centroid / area : centroid;
+    float len = glm::length(normal);
+    normals[c] = len > 0.0f ? normal / len : normal;
+  }
+  if (mesh_area > 0.0f) {
+    mesh_centroid /= mesh_area;
+  }
+
+  std::vector<float> sort_key(n_clusters);
+  for (size_t c = 0; c < n_clusters; c++) {
+    sort_key[c] = glm::dot(centroids[c] - mesh_centroid, normals[c]);
+  }
+  std::vector<size_t> order(n_clusters);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return sort_key[a] > sort_key[b];
+  });
+
+  std::vector<unsigned int> result;
+  result.reserve(indices.size());
+  for (size_t c : order) {
+    result.insert(result.end(), indices.begin() + clusters[c] * 3,
+                  indices.begin() + clusters[c + 1] * 3);
+  }
+  indices.swap(result);
+}
+
+// Reorders vertices by first use in the index buffer and drops unreferenced
+// ones. Returns the new vertex count.
+inline size_t optimize_vertex_fetch(std::vector<Vertex> &vertices,
+                                    std::vector<unsigned int> &indices) {
+  constexpr unsigned int UNUSED = ~0u;
+  std::vector<unsigned int> remap(vertices.size(), UNUSED);
+  std::vector<Vertex> result;
+  result.reserve(vertices.size());
+  for (unsigned int &index : indices) {
+    if (remap[index] == UNUSED) {
+      remap[index] = result.size();
+      result.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices.swap(result);
+  return vertices.size();
+}
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+
+// Quadric error edge-collapse simplification (Garland & Heckbert) for
+// indexed triangle lists. Collapses are half-edge collapses onto existing
+// vertices, so every simplified level indexes the original vertex buffer and
+// LOD levels can share it.
+//
+// Vertices identical in position, normal and texture coordinates, such as
+// the per-corner copies of an unwelded import, are treated as one vertex.
+// Attribute seams (one position, several normals or UVs) and non-manifold
+// vertices never move. Border vertices only slide along their
+// border edges, which keeps open outlines intact.
+
+namespace detail {
+
+struct Quadric {
+  // upper triangle of the symmetric 4x4 matrix sum(p * p^T) over planes
+  // p = (n, d).
+  double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+  double a11 = 0, a12 = 0, a13 = 0;
+  double a22 = 0, a23 = 0;
+  double a33 = 0;
+
+  void add_plane(const glm::vec3 &n, float d, float weight) {
+    double x = n.x, y = n.y, z = n.z, w = d;
+    a00 += weight * x * x;
+    a01 += weight * x * y;
+    a02 += weight * x * z;
+    a03 += weight * x * w;
+    a11 += weight * y * y;
+    a12 += weight * y * z;
+    a13 += weight * y * w;
+    a22 += weight * z * z;
+    a23 += weight * z * w;
+    a33 += weight * w * w;
+  }
+
+  void add(const Quadric &q) {
+    a00 += q.a00, a01 += q.a01, a02 += q.a02, a03 += q.a03;
+    a11 += q.a11, a12 += q.a12, a13 += q.a13;
+    a22 += q.a22, a23 += q.a23;
+    a33 += q.a33;
+  }
+
+  // sum of squared distances of `p` to the accumulated planes.
+  double evaluate(const glm::vec3 &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double r = a00 * x * x + a11 * y * y + a22 * z * z + a33;
+    r += 2 * (a01 * x * y + a02 * x * z + a12 * y * z);
+    r += 2 * (a03 * x + a13 * y + a23 * z);
+    return r < 0 ? 0 : r;
+  }
+};
+
+enum class VertexKind : uint8_t { MANIFOLD, BORDER, LOCKED };
+
+struct Collapse {
+  unsigned int v0;
+  unsigned int v1;
+  float cost;
+};
+
+inline uint64_t edge_key(unsigned int a, unsigned int b) {
+  return (uint64_t)a << 32 | b;
+}
+
+} // namespace detail
+
+// Simplifies `indices` towards `target_index_count` without exceeding
+// `target_error` (object-space distance). Returns the new index list;
+// `result_error` receives the largest error introduced.
+inline std::vector<unsigned int>
+simplify_mesh(const std::vector<unsigned int> &indices,
+              const std::vector<Vertex> &vertices, size_t target_index_count,
+              float target_error, float *result_error = nullptr) {
+  using namespace detail;
+  size_t n = vertices.size();
+  std::vector<unsigned int> result = indices;
+  if (result_error) {
+    *result_error = 0.0f;
+  }
+  if (result.size() <= target_index_count || n == 0) {
+    return result;
+  }
+
+  // canonical vertex per distinct position, to see through attribute seams,
+  // and the distinct attribute sets (wedges) at each position. indices are
+  // redirected to the first of any identical vertices.
+  std::vector<unsigned int> canonical(n);
+  std::vector<unsigned int> wedges(n, 0);
+  {
+    // the canonical vertex's distinct wedges as a list through `next_wedge`.
+    std::vector<unsigned int> next_wedge(n, ~0u), same(n);
+    struct PositionHash {
+      size_t operator()(const glm::vec3 &p) const {
+        // + 0 turns -0 into 0, which compares equal to it.
+        float q[3] = {p.x + 0.0f, p.y + 0.0f, p.z + 0.0f};
+        uint32_t h[3];
+        std::memcpy(h, q, sizeof(h));
+        return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+      }
+    };
+    std::unordered_map<glm::vec3, unsigned int, PositionHash> positions;
+    positions.reserve(n);
+    for (unsigned int v = 0; v < n; v++) {
+      unsigned int c = positions.emplace(vertices[v].position, v).first->second;
+      canonical[v] = c;
+      same[v] = v;
+      for (unsigned int w = c; w != v && w != ~0u; w = next_wedge[w]) {
+        if (vertices[w].normal == vertices[v].normal &&
+            vertices[w].tex_coords == vertices[v].tex_coords) {
+          same[v] = w;
+          break;
+        }
+      }
+      if (same[v] == v) {
+        wedges[c]++;
+        if (v != c) {
+          next_wedge[v] = next_wedge[c];
+          next_wedge[c] = v;
+        }
+      }
+    }
+    for (unsigned int &index : result) {
+      index = same[index];
+    }
+  }
+
+  // classify vertices from directed edge usage in position space: an edge is
+  // open if its reverse is missing, non-manifold if it repeats.
+  std::vector<VertexKind> kind(n, VertexKind::MANIFOLD);
+  std::vector<unsigned int> border_next(n, ~0u), border_prev(n, ~0u);
+  {
+    std::unordered_map<uint64_t, unsigned int> edges;
+    edges.reserve(result.size());
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        unsigned int a = canonical[result[i + k]];
+        unsigned int b = canonical[result[i + (k + 1) % 3]];
+        edges[edge_key(a, b)]++;
+      }
+    }
+
+    std::vector<unsigned int> open_out(n, 0), open_in(n, 0);
+    std::vector<bool> complex(n, false);
+    for (const auto &[key, count] : edges) {
+      unsigned int a = key >> 32, b = key & 0xffffffffu;
+      if (count > 1) {
+        complex[a] = complex[b] = true;
+      }
+      if (!edges.count(edge_key(b, a))) {
+        open_out[a]++;
+        open_in[b]++;
+        border_next[a] = b;
+        border_prev[b] = a;
+      }
+    }
+
+    for (unsigned int v = 0; v < n; v++) {
+      unsigned int c = canonical[v];
+      if (wedges[c] > 1 || complex[c]) {
+        kind[v] = VertexKind::LOCKED;
+      } else if (open_out[c] == 0 && open_in[c] == 0) {
+        kind[v] = VertexKind::MANIFOLD;
+      } else if (open_out[c] == 1 && open_in[c] == 1) {
+        kind[v] = VertexKind::BORDER;
+      } else {
+        kind[v] = VertexKind::LOCKED;
+      }
+    }
+  }
+
+  // plane quadrics per vertex, plus planes through open edges perpendicular
+  // to the surface so borders resist moving inwards.
+  std::vector<Quadric> quadrics(n);
+  for (size_t i = 0; i < result.size(); i += 3) {
+    const glm::vec3 p[3] = {vertices[result[i]].position,
+                            vertices[result[i + 1]].position,
+                            vertices[result[i + 2]].position};
+    glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+    float area = glm::length(normal);
+    if (area == 0.0f) {
+      continue;
+    }
+    normal /= area;
+    for (int k = 0; k < 3; k++) {
+      quadrics[result[i + k]].add_plane(normal, -glm::dot(normal, p[0]), 1.0f);
+    }
+
+    for (int k = 0; k < 3; k++) {
+      unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+      if (border_next[canonical[a]] != canonical[b]) {
+        continue;
+      }
+      glm::vec3 edge = p[(k + 1) % 3] - p[k];
+      glm::vec3 side = glm::cross(edge, normal);
+      float length = glm::length(side);
+      if (length == 0.0f) {
+        continue;
+      }
+      side /= length;
+      float d = -glm::dot(side, p[k]);
+      quadrics[a].add_plane(side, d, 1.0f);
+      quadrics[b].add_plane(side, d, 1.0f);
+    }
+  }
+
+  auto can_collapse = [&](unsigned int v0, unsigned int v1) {
+    switch (kind[v0]) {
+    case VertexKind::MANIFOLD:
+      return true;
+    case VertexKind::BORDER:
+      return border_next[canonical[v0]] == canonical[v1] ||
+             border_prev[canonical[v0]] == canonical[v1];
+    default:
+      return false;
+    }
+  };
+
+  double error_limit = (double)target_error * target_error;
+  double max_error = 0.0;
+  std::vector<unsigned int> remap(n);
+  std::vector<bool> locked(n);
+  std::vector<unsigned int> offsets(n + 1), adjacency;
+  std::vector<Collapse> collapses;
+
+  while (result.size() > target_index_count) {
+    size_t n_triangles = result.size() / 3;
+
+    collapses.clear();
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+        for (int dir = 0; dir < 2; dir++, std::swap(a, b)) {
+          if (!can_collapse(a, b)) {
+            continue;
+          }
+          Quadric q = quadrics[a];
+          q.add(quadrics[b]);
+          collapses.push_back({a, b, (float)q.evaluate(vertices[b].position)});
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &x, const Collapse &y) {
+                return x.cost < y.cost;
+              });
+
+    // vertex -> triangle adjacency for the flip test.
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (unsigned int index : result) {
+      offsets[index + 1]++;
+    }
+    for (size_t v = 0; v < n; v++) {
+      offsets[v + 1] += offsets[v];
+    }
+    adjacency.resize(result.size());
+    {
+      std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < result.size(); i++) {
+        adjacency[fill[result[i]]++] = i / 3;
+      }
+    }
+
+    // rejects collapses that would turn a remaining triangle around v0 over.
+    auto flips = [&](unsigned int v0, unsigned int v1) {
+      const glm::vec3 &target = vertices[v1].position;
+      for (unsigned int j = offsets[v0]; j < offsets[v0 + 1]; j++) {
+        const unsigned int *tri = &result[adjacency[j] * 3];
+        if (tri[0] == v1 || tri[1] == v1 || tri[2] == v1) {
+          continue;
+        }
+        glm::vec3 p[3], q[3];
+        for (int k = 0; k < 3; k++) {
+          p[k] = vertices[tri[k]].position;
+          q[k] = tri[k] == v0 ? target : p[k];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <= 0.0f) {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    for (size_t v = 0; v < n; v++) {
+      remap[v] = v;
+    }
+    std::fill(locked.begin(), locked.end(), false);
+
+    size_t goal = n_triangles - target_index_count / 3;
+    size_t removed = 0;
+    size_t applied = 0;
+    for (const Collapse &c : collapses) {
+      if (c.cost > error_limit) {
+        break;
+      }
+      if (locked[c.v0] || locked[c.v1] || flips(c.v0, c.v1)) {
+        continue;
+      }
+
+      remap[c.v0] = c.v1;
+      quadrics[c.v1].add(quadrics[c.v0]);
+      if (kind[c.v0] == VertexKind::BORDER) {
+        // splice v0 out of its border loop.
+        unsigned int a = canonical[c.v0], b = canonical[c.v1];
+        if (border_next[a] == b) {
+          border_prev[b] = border_prev[a];
+          border_next[border_prev[a]] = b;
+        } else {
+          border_next[b] = border_next[a];
+          border_prev[border_next[a]] = b;
+        }
+      }
+      max_error = std::max(max_error, (double)c.cost);
+      applied++;
+
+      // the triangles around v0 change shape, so their other collapses are
+      // re-evaluated in the next pass.
+      for (unsigned int j = offsets[c.v0]; j < offsets[c.v0 + 1]; j++) {
+        const unsigned int *tri = &result[adjacency[j] * 3];
+        locked[tri[0]] = locked[tri[1]] = locked[tri[2]] = true;
+      }
+      locked[c.v1] = true;
+
+      removed += kind[c.v0] == VertexKind::BORDER ? 1 : 2;
+      if (removed >= goal) {
+        break;
+      }
+    }
+    if (applied == 0) {
+      break;
+    }
+
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      unsigned int a = remap[result[i]];
+      unsigned int b = remap[result[i + 1]];
+      unsigned int c = remap[result[i + 2]];
+      if (a != b && b != c && c != a) {
+        result[write++] = a;
+        result[write++] = b;
+        result[write++] = c;
+      }
+    }
+    result.resize(write);
+  }
+
+  if (result_error) {
+    *result_error = (float)std::sqrt(max_error);
+  }
+  return result;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+
+// Per-attribute distance (largest component difference) up to which two
+// vertices are merged. All zero merges bit-identical vertices only.
+struct WeldTolerance {
+  float position = 0.0f;
+  float normal = 0.0f;
+  float tex_coord = 0.0f;
+
+  bool exact() const {
+    return position == 0.0f && normal == 0.0f && tex_coord == 0.0f;
+  }
+};
+
+namespace detail {
+
+inline uint64_t weld_hash(const void *data, size_t size) {
+  // FNV-1a over 32-bit words; vertices are a handful of floats.
+  const uint32_t *words = static_cast<const uint32_t *>(data);
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size / 4; i++) {
+    h = (h ^ words[i]) * 0x100000001b3ull;
+  }
+  return h ^ (h >> 29);
+}
+
+inline bool within(const glm::vec3 &a, const glm::vec3 &b, float tolerance) {
+  glm::vec3 d = glm::abs(a - b);
+  return d.x <= tolerance && d.y <= tolerance && d.z <= tolerance;
+}
+
+inline bool within(const glm::vec2 &a, const glm::vec2 &b, float tolerance) {
+  glm::vec2 d = glm::abs(a - b);
+  return d.x <= tolerance && d.y <= tolerance;
+}
+
+// remaps `indices` through `remap` and keeps the first vertex of each class.
+inline size_t apply_weld(std::vector<Vertex> &vertices,
+                         std::vector<unsigned int> &indices,
+                         const std::vector<unsigned int> &remap) {
+  std::vector<unsigned int> compact(vertices.size(), ~0u);
+  size_t count = 0;
+  for (size_t v = 0; v < vertices.size(); v++) {
+    if (remap[v] == v) {
+      compact[v] = count;
+      vertices[count++] = vertices[v];
+    }
+  }
+  for (unsigned int &index : indices) {
+    index = compact[remap[index]];
+  }
+  vertices.resize(count);
+  return count;
+}
+
+} // namespace detail
+
+// Merges duplicate vertices and rewrites `indices` to match. Survivors keep
+// their relative order. Returns the new vertex count.
+inline size_t weld_vertices(std::vector<Vertex> &vertices,
+                            std::vector<unsigned int> &indices,
+                            const WeldTolerance &tolerance = WeldTolerance()) {
+  using namespace detail;
+  size_t n = vertices.size();
+  if (n == 0) {
+    return 0;
+  }
+  std::vector<unsigned int> remap(n);
+
+  // both paths key on float bits, in which -0 and 0 differ; + 0 makes every
+  // zero positive, as OBJ exports are full of -0.000000.
+  for (Vertex &vertex : vertices) {
+    for (int k = 0; k < 3; k++) {
+      vertex.position[k] += 0.0f;
+      vertex.normal[k] += 0.0f;
+    }
+    vertex.tex_coords[0] += 0.0f;
+    vertex.tex_coords[1] += 0.0f;
+  }
+
+  if (tolerance.exact()) {
+    static_assert(sizeof(Vertex) == 8 * sizeof(float),
+                  "Vertex must not contain padding to be hashed bytewise");
+    size_t capacity = 16;
+    while (capacity < n * 2) {
+      capacity *= 2;
+    }
+    std::vector<unsigned int> table(capacity, ~0u);
+    for (unsigned int v = 0; v < n; v++) {
+      size_t slot = weld_hash(&vertices[v], sizeof(Vertex)) & (capacity - 1);
+      for (;; slot = (slot + 1) & (capacity - 1)) {
+        if (table[slot] == ~0u) {
+          table[slot] = v;
+          remap[v] = v;
+          break;
+        }
+        const Vertex &other = vertices[table[slot]];
+        if (std::memcmp(&other, &vertices[v], sizeof(Vertex)) == 0) {
+          remap[v] = table[slot];
+          break;
+        }
+      }
+    }
+    return apply_weld(vertices, indices, remap);
+  }
+
+  // greedy clustering on a grid of position-tolerance cells: a vertex joins
+  // the first earlier representative within tolerance in its 27 neighbouring
+  // cells. with no position tolerance only equal positions are compared.
+  float cell = tolerance.position;
+  auto cell_key = [&](const glm::vec3 &p, int dx, int dy, int dz) {
+    int32_t c[3];
+    const int offset[3] = {dx, dy, dz};
+    for (int k = 0; k < 3; k++) {
+      if (cell > 0.0f) {
+        c[k] = (int32_t)std::floor(p[k] / cell) + offset[k];
+      } else {
+        std::memcpy(&c[k], &p[k], sizeof(float));
+      }
+    }
+    return weld_hash(c, sizeof(c));
+  };
+
+  // cell -> representatives, chained through `next`.
+  std::unordered_map<uint64_t, unsigned int> heads;
+  heads.reserve(n);
+  std::vector<unsigned int> next(n, ~0u);
+  int reach = cell > 0.0f ? 1 : 0;
+
+  for (unsigned int v = 0; v < n; v++) {
+    const Vertex &vertex = vertices[v];
+    remap[v] = v;
+
+    bool found = false;
+    for (int dx = -reach; dx <= reach && !found; dx++) {
+      for (int dy = -reach; dy <= reach && !found; dy++) {
+        for (int dz = -reach; dz <= reach && !found; dz++) {
+          auto it = heads.find(cell_key(vertex.position, dx, dy, dz));
+          if (it == heads.end()) {
+            continue;
+          }
+          for (unsigned int r = it->second; r != ~0u; r = next[r]) {
+            const Vertex &other = vertices[r];
+            if (within(vertex.position, other.position, tolerance.position) &&
+                within(vertex.normal, other.normal, tolerance.normal) &&
+                within(vertex.tex_coords, other.tex_coords,
+                       tolerance.tex_coord)) {
+              remap[v] = r;
+              found = true;
+              break;
+            }
+          }
+        }
+      }
+    }
+
+    if (!found) {
+      uint64_t key = cell_key(vertex.position, 0, 0, 0);
+      auto [it, inserted] = heads.emplace(key, v);
+      if (!inserted) {
+        next[v] = it->second;
+        it->second = v;
+      }
+    }
+  }
+  return apply_weld(vertices, indices, remap);
+}
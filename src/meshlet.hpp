@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+
+constexpr size_t MESHLET_MAX_VERTICES = 64;
+constexpr size_t MESHLET_MAX_TRIANGLES = 124;
+
+namespace detail {
+
+inline Meshlet finish_meshlet(const std::vector<unsigned int> &indices,
+                              const std::vector<Vertex> &vertices,
+                              size_t begin, size_t end) {
+  Meshlet m;
+  m.index_offset = begin;
+  m.index_count = end - begin;
+
+  glm::vec3 lo = vertices[indices[begin]].position, hi = lo;
+  for (size_t i = begin; i < end; i++) {
+    lo = glm::min(lo, vertices[indices[i]].position);
+    hi = glm::max(hi, vertices[indices[i]].position);
+  }
+  m.center = (lo + hi) * 0.5f;
+  m.radius = 0.0f;
+  for (size_t i = begin; i < end; i++) {
+    m.radius = glm::max(m.radius,
+                        glm::length(vertices[indices[i]].position - m.center));
+  }
+
+  // the cone axis is the average face normal; its spread is the largest
+  // angle between the axis and any face normal.
+  std::vector<glm::vec3> normals;
+  normals.reserve((end - begin) / 3);
+  glm::vec3 axis(0.0f);
+  for (size_t i = begin; i < end; i += 3) {
+    const glm::vec3 &a = vertices[indices[i]].position;
+    const glm::vec3 &b = vertices[indices[i + 1]].position;
+    const glm::vec3 &c = vertices[indices[i + 2]].position;
+    glm::vec3 n = glm::cross(b - a, c - a);
+    float length = glm::length(n);
+    if (length > 0.0f) {
+      normals.push_back(n / length);
+      axis += n / length;
+    }
+  }
+
+  float axis_length = glm::length(axis);
+  m.cone_axis = axis_length > 0.0f ? axis / axis_length : glm::vec3(0.0f);
+  // a cutoff of 1 never culls.
+  m.cone_cutoff = 1.0f;
+  if (axis_length > 0.0f) {
+    float min_dot = 1.0f;
+    for (const glm::vec3 &n : normals) {
+      min_dot = glm::min(min_dot, glm::dot(n, m.cone_axis));
+    }
+    if (min_dot > 0.0f) {
+      m.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+    }
+  }
+  return m;
+}
+
+} // namespace detail
+
+// Splits indices [begin, end) into meshlets by walking the triangles in
+// order, so every meshlet stays a contiguous index range that can be drawn
+// without rewriting the index buffer. Works best on cache-optimized indices,
+// where consecutive triangles are spatially close.
+inline std::vector<Meshlet>
+build_meshlets(const std::vector<unsigned int> &indices,
+               const std::vector<Vertex> &vertices, size_t begin, size_t end) {
+  std::vector<Meshlet> meshlets;
+  // which meshlet a vertex was last seen in, to count unique vertices.
+  std::vector<uint32_t> seen_in(vertices.size(), ~0u);
+  uint32_t current = 0;
+  size_t start = begin;
+  size_t unique = 0;
+
+  for (size_t i = begin; i + 2 < end; i += 3) {
+    size_t added = 0;
+    for (int k = 0; k < 3; k++) {
+      added += seen_in[indices[i + k]] != current;
+    }
+
+    if (unique + added > MESHLET_MAX_VERTICES ||
+        (i - start) / 3 + 1 > MESHLET_MAX_TRIANGLES) {
+      meshlets.push_back(detail::finish_meshlet(indices, vertices, start, i));
+      current++;
+      start = i;
+      unique = 0;
+    }
+
+    for (int k = 0; k < 3; k++) {
+      if (seen_in[indices[i + k]] != current) {
+        seen_in[indices[i + k]] = current;
+        unique++;
+      }
+    }
+  }
+  if (start < end) {
+    meshlets.push_back(detail::finish_meshlet(indices, vertices, start, end));
+  }
+  return meshlets;
+}
+
+// True if every triangle of the meshlet faces away from `camera`, given in
+// the meshlet's object space.
+inline bool meshlet_backfacing(const Meshlet &m, const glm::vec3 &camera) {
+  glm::vec3 to_center = m.center - camera;
+  return glm::dot(to_center, m.cone_axis) >=
+         m.cone_cutoff * glm::length(to_center) + m.radius;
+}
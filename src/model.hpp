@@ -1,6 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -14,56 +22,1218 @@
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include "asset_cache.hpp"
+#include "bvh.hpp"
+#include "frustum.hpp"
+#include "geometry_arena.hpp"
+#include "gltf_loader.hpp"
+#include "hash.hpp"
+#include "instance_set.hpp"
+#include "load_profiler.hpp"
 #include "mesh.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_weld.hpp"
+#include "mesh_simplifier.hpp"
+#include "meshlet.hpp"
+#include "obj_loader.hpp"
+#include "raycast.hpp"
+#include "scene_graph.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
+#include "texture_registry.hpp"
+#include "thread_pool.hpp"
 
-std::vector<Texture> textures_loaded;
+struct DrawStats {
+  size_t draw_calls = 0;
+  size_t triangles = 0;
+  size_t meshes_culled = 0;
+  size_t clusters = 0;
+  size_t clusters_culled = 0;
+  size_t vao_binds = 0;
+  // drawn by instanced draws, after culling.
+  size_t instances = 0;
+};
+
+// Per-draw view state for CPU-side decisions such as LOD selection.
+struct DrawContext {
+  // placement of the whole model; each mesh is further transformed by its
+  // scene graph node.
+  glm::mat4 model = glm::mat4(1.0f);
+  glm::mat4 view = glm::mat4(1.0f);
+  glm::mat4 projection = glm::mat4(1.0f);
+  float viewport_height = 1.0f;
+  // screen-space error in pixels a LOD level may introduce. 0 always draws
+  // full detail.
+  float lod_bias = 1.0f;
+  // frustum and backface-cone culling of level 0 meshlets.
+  bool cluster_culling = true;
+  // drawn tinted, e.g. the mesh under the cursor.
+  const Mesh *highlight = nullptr;
+  DrawStats *stats = nullptr;
+};
+
+class Model;
+
+// Closest hit of a ray with the models it was cast against. `t` only ever
+// decreases, so one RayHit can be passed to several Model::raycast() calls.
+struct RayHit {
+  const Model *model = nullptr;
+  const Mesh *mesh = nullptr;
+  size_t mesh_index = 0;
+  // level 0 triangle of the mesh: indices 3 * triangle .. 3 * triangle + 2.
+  uint32_t triangle = 0;
+  float t = FLT_MAX;
+  // world space.
+  glm::vec3 position = glm::vec3(0.0f);
+  // weights of the triangle's second and third vertex.
+  glm::vec2 barycentric = glm::vec2(0.0f);
+
+  explicit operator bool() const { return model != nullptr; }
+};
+
+struct ModelOptions {
+  // GPU vertex layout. PACKED halves vertex memory at reduced precision
+  // (half-float texture coordinates); meshes that cannot be packed without
+  // visible loss keep full floats.
+  VertexFormat vertex_format = VertexFormat::FLOAT;
+  // merge vertices within `weld_tolerance` on import; the default tolerance
+  // only merges bit-identical ones. bit-identical duplicates are merged even
+  // when this is off, as the cache optimizations need shared vertices.
+  bool weld_vertices = true;
+  WeldTolerance weld_tolerance;
+  // host copies of the geometry after upload. applied once the mesh cache has
+  // been written.
+  GeometryRetention retention = GeometryRetention::DISCARD;
+  // a BVH over each mesh's triangles, for CPU queries such as picking. costs
+  // a copy of the vertex positions per mesh.
+  bool triangle_bvh = true;
+};
+
+// Memory held by one model. Textures are shared between models through the
+// registry and not included.
+struct MemoryUsage {
+  // geometry copies and per-mesh metadata.
+  size_t host_bytes = 0;
+  // geometry in the arena buffers.
+  size_t gpu_bytes = 0;
+  // arena buffer allocations, including room for growth.
+  size_t gpu_allocated_bytes = 0;
+};
+
+enum class LoadState { LOADING, READY, FAILED };
+
+struct LoadProgress {
+  LoadState state;
+  size_t meshes_loaded;
+  // 0 until the source file has been parsed.
+  size_t meshes_total;
+};
 
 class Model {
 public:
-  Model(const char *path) { load_model(path); }
+  // Returns right away. The file is imported in the background and meshes
+  // appear over the following update() calls; until then draw() shows
+  // whatever has arrived.
+  Model(const char *path, ModelOptions options = ModelOptions())
+    : options(options), source(path) {
+    load_model(source);
+  }
+
+  ~Model() {
+    // jobs still running reference this model and the importer's scene.
+    if (pending) {
+      if (pending->import.valid()) {
+        pending->import.wait();
+      }
+      for (auto &job : pending->jobs) {
+        if (job.valid()) {
+          job.wait();
+        }
+      }
+    }
+    if (cache_writer.valid()) {
+      cache_writer.wait();
+    }
+
+    for (auto &mesh : meshes) {
+      for (auto &texture : mesh.textures) {
+        if (texture.path.empty()) {
+          texture_registry().release_default(texture.type);
+        } else {
+          texture_registry().release(texture.path);
+        }
+      }
+    }
+  }
+
+  // meshes hold registry references that are released exactly once.
+  Model(const Model &) = delete;
+  Model &operator=(const Model &) = delete;
+
+  // GL thread, once per frame. uploads meshes that finished loading, spending
+  // roughly `budget_seconds` on it.
+  void update(double budget_seconds = 0.004) {
+    if (pending) {
+      upload_pending(budget_seconds);
+    }
+    // a cold load keeps its host geometry until the cache is written.
+    if (cache_writer.valid() &&
+        cache_writer.wait_for(std::chrono::seconds(0)) ==
+          std::future_status::ready) {
+      cache_writer.get();
+      for (Mesh &mesh : meshes) {
+        mesh.retain(options.retention);
+      }
+    }
+    if (replacement) {
+      replacement->update(budget_seconds);
+      finish_reload();
+    }
+  }
+
+  // true if a change to `path` calls for reload(): the source itself, or a
+  // material library it names.
+  bool depends_on(const std::string &path) const {
+    std::filesystem::path changed =
+      std::filesystem::path(path).lexically_normal();
+    if (changed == std::filesystem::path(source).lexically_normal()) {
+      return true;
+    }
+    MappedFile file;
+    if (!has_extension(path, ".mtl") || !has_extension(source, ".obj") ||
+        !file.open(source)) {
+      return false;
+    }
+    const char *text = reinterpret_cast<const char *>(file.data());
+    std::string dir = source.substr(0, source.find_last_of('/'));
+    for (const std::string &library :
+         obj_material_libraries(text, text + file.size())) {
+      std::filesystem::path named = dir + "/" + library;
+      if (named.lexically_normal() == changed) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Imports the source again in the background while the current meshes
+  // keep being drawn. Once the new meshes are all
+  // uploaded, update() swaps them in between two frames. Transforms set
+  // through scene_graph() are reset by the swap.
+  void reload() {
+    if (replacement) {
+      // the import in flight may have read the old file.
+      reload_queued = true;
+      return;
+    }
+    replacement.reset(new Model(source.c_str(), options));
+  }
+
+  MemoryUsage memory_usage() const {
+    MemoryUsage usage;
+    usage.host_bytes = meshes.capacity() * sizeof(Mesh) + bvh.byte_size() +
+                       mesh_bounds.capacity() * sizeof(Aabb);
+    for (const Mesh &mesh : meshes) {
+      usage.host_bytes += mesh.host_bytes();
+      usage.gpu_bytes += mesh.gpu_bytes();
+    }
+    usage.gpu_allocated_bytes = arena.vertex_capacity() +
+                                arena.index_capacity();
+    return usage;
+  }
+
+  LoadProgress progress() const {
+    return {load_state, meshes.size(), meshes_total};
+  }
+
+  const std::string &source_path() const { return source; }
+
+  // node transforms of the imported file. changes made through set_local()
+  // take effect at the next draw().
+  SceneGraph &scene_graph() { return graph; }
+
+  // BVH over the meshes' bounds in model space, built once loading is done
+  // and refit when the scene graph moves. primitives index the mesh list.
+  const Bvh &mesh_bvh() const { return bvh; }
+
+  // Updates `hit` if `ray` (world space) hits this model closer than
+  // hit.t, with the model placed by `model` as in DrawContext. Only meshes
+  // with a triangle BVH can be hit; nothing can before loading finishes.
+  bool raycast(const Ray &ray, const glm::mat4 &model, RayHit &hit) const {
+    Ray local = transform_ray(ray, glm::inverse(model));
+    float t_max = std::min(ray.t_max, hit.t);
+    bool found = false;
+    detail::traverse_ray(
+      bvh, local, t_max, [&](uint32_t first, uint32_t count, float &t) {
+        for (uint32_t k = 0; k < count; k++) {
+          size_t index = bvh.primitives[first + k];
+          const Mesh &mesh = meshes[index];
+          if (mesh.triangle_bvh.empty()) {
+            continue;
+          }
+          Ray mesh_ray =
+            transform_ray(local, glm::inverse(graph.world(mesh.node)));
+          mesh_ray.t_max = t;
+          TriangleHit triangle;
+          if (::raycast(mesh.triangle_bvh, mesh_ray, triangle)) {
+            t = triangle.t;
+            hit.model = this;
+            hit.mesh = &mesh;
+            hit.mesh_index = index;
+            hit.triangle = triangle.triangle;
+            hit.t = triangle.t;
+            hit.position = ray.origin + ray.direction * triangle.t;
+            hit.barycentric = glm::vec2(triangle.u, triangle.v);
+            found = true;
+          }
+        }
+      });
+    return found;
+  }
+
+  // sets the "model" and "normalMatrix" uniforms per scene graph node.
+  void draw(Shader &shader, const DrawContext &ctx) {
+    DrawStats ignored;
+    DrawStats &stats = ctx.stats ? *ctx.stats : ignored;
+    if (graph.update() && !bvh.empty()) {
+      update_mesh_bounds();
+      bvh.refit(mesh_bounds);
+    }
+
+    // per-node state. meshes of one node are adjacent, so it is recomputed
+    // once per node rather than per mesh.
+    uint32_t node = SceneGraph::NO_PARENT;
+    glm::mat4 model_view;
+    float scale = 1.0f;
+    Frustum frustum;
+    glm::vec3 camera;
+    auto enter_node = [&](uint32_t next) {
+      if (next == node) {
+        return;
+      }
+      node = next;
+      glm::mat4 model = ctx.model * graph.world(node);
+      model_view = ctx.view * model;
+      scale = glm::max(glm::length(glm::vec3(model[0])),
+                       glm::max(glm::length(glm::vec3(model[1])),
+                                glm::length(glm::vec3(model[2]))));
+      // culling happens in object space, so nothing per-cluster is
+      // transformed.
+      frustum = Frustum::from_matrix(ctx.projection * model_view);
+      camera = glm::vec3(glm::inverse(model_view) *
+                         glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+      shader.use();
+      shader.set_mat4("model", model);
+      shader.set_mat3("normalMatrix",
+                      glm::transpose(glm::inverse(glm::mat3(model_view))));
+    };
+
+    // meshes share one VAO per vertex format, so it only changes when the
+    // format does.
+    unsigned int bound_vao = 0;
+    auto bind_vao = [&](const Mesh &mesh) {
+      if (mesh.vao != bound_vao) {
+        glBindVertexArray(mesh.vao);
+        bound_vao = mesh.vao;
+        stats.vao_binds++;
+      }
+    };
+
+    bool highlighted = false;
+    shader.use();
+    shader.set_vec3("highlight", glm::vec3(0.0f));
+
+    for (auto &mesh : meshes) {
+      enter_node(mesh.node);
+      glm::vec3 center = (mesh.aabb_min + mesh.aabb_max) * 0.5f;
+      float radius = glm::length(mesh.aabb_max - mesh.aabb_min) * 0.5f;
+      if (!frustum.intersects_sphere(center, radius)) {
+        stats.meshes_culled++;
+        stats.clusters += mesh.meshlets.size();
+        stats.clusters_culled += mesh.meshlets.size();
+        continue;
+      }
+
+      if ((&mesh == ctx.highlight) != highlighted) {
+        highlighted = !highlighted;
+        shader.set_vec3("highlight", highlighted ? glm::vec3(0.25f, 0.2f, 0.0f)
+                                                 : glm::vec3(0.0f));
+      }
+
+      size_t level = select_lod(mesh, model_view, scale, ctx);
+      if (level == 0 && ctx.cluster_culling && !mesh.meshlets.empty()) {
+        if (cull_meshlets(mesh, frustum, camera, stats)) {
+          bind_vao(mesh);
+          mesh.draw_ranges(shader, range_counts, range_offsets,
+                           range_base_vertices);
+          stats.draw_calls++;
+        }
+        continue;
+      }
+
+      bind_vao(mesh);
+      mesh.draw(shader, level);
+      stats.draw_calls++;
+      stats.triangles += mesh.lod(level).index_count / 3;
+      stats.clusters += mesh.meshlets.size();
+    }
+    if (highlighted) {
+      shader.set_vec3("highlight", glm::vec3(0.0f));
+    }
+    glBindVertexArray(0);
+  }
+
+  // Draws every instance of `instances` with one instanced draw per mesh.
+  // ctx.model is ignored: the instances place the model. Instances are culled
+  // as a whole against the model's bounds and drawn at full detail; LOD
+  // selection and meshlet culling only apply to the draw above.
+  void draw(Shader &shader, const DrawContext &ctx,
+            ModelInstanceSet &instances) {
+    DrawStats ignored;
+    DrawStats &stats = ctx.stats ? *ctx.stats : ignored;
+    if (graph.update() && !bvh.empty()) {
+      update_mesh_bounds();
+      bvh.refit(mesh_bounds);
+    }
+    if (meshes.empty()) {
+      return;
+    }
+
+    Aabb bounds = model_bounds();
+    float radius = glm::length(bounds.max - bounds.min) * 0.5f;
+    size_t count = instances.upload(bounds.center(), radius,
+                                    ctx.projection * ctx.view);
+    if (count == 0) {
+      return;
+    }
+    stats.instances += count;
+
+    // normals reach basic.frag in world space, placed by the instance
+    // matrix in basic.vert.
+    shader.use();
+    shader.set_bool("instanced", true);
+    shader.set_vec3("highlight", glm::vec3(0.0f));
+    shader.set_mat3("normalMatrix",
+                    glm::transpose(glm::inverse(glm::mat3(ctx.view))));
 
-  void draw(Shader &shader) {
+    // the instance attributes are VAO state, set on each arena VAO used and
+    // cleared again afterwards.
+    std::vector<unsigned int> touched;
+    uint32_t node = SceneGraph::NO_PARENT;
+    unsigned int bound_vao = 0;
     for (auto &mesh : meshes) {
-      mesh.draw(shader);
+      if (mesh.vao != bound_vao) {
+        glBindVertexArray(mesh.vao);
+        bound_vao = mesh.vao;
+        stats.vao_binds++;
+        if (std::find(touched.begin(), touched.end(), mesh.vao) ==
+            touched.end()) {
+          instances.bind_attributes();
+          touched.push_back(mesh.vao);
+        }
+      }
+      if (mesh.node != node) {
+        node = mesh.node;
+        shader.set_mat4("model", graph.world(node));
+      }
+      mesh.draw_instanced(shader, (GLsizei)count);
+      stats.draw_calls++;
+      stats.triangles += mesh.lod(0).index_count / 3 * count;
+    }
+
+    for (unsigned int vao : touched) {
+      glBindVertexArray(vao);
+      ModelInstanceSet::unbind_attributes();
     }
+    glBindVertexArray(0);
+    shader.set_bool("instanced", false);
   }
 
 private:
+  static constexpr size_t MAX_LODS = 4;
+
+  ModelOptions options;
+  std::string source;
+  // vertex and index storage of every mesh; declared first so it outlives
+  // them.
+  GeometryArena arena;
   std::vector<Mesh> meshes;
+  SceneGraph graph;
+  Bvh bvh;
+  // model-space bounds of each mesh, the primitives of `bvh`.
+  std::vector<Aabb> mesh_bounds;
   std::string directory;
+  // writes the mesh cache after a cold load, reading `meshes`.
+  std::future<void> cache_writer;
+
+  // scratch for cull_meshlets, reused across frames.
+  std::vector<GLsizei> range_counts;
+  std::vector<const void *> range_offsets;
+  std::vector<GLint> range_base_vertices;
+
+  // culls the level 0 meshlets of `mesh` and collects the survivors as index
+  // ranges for a single multi-draw, merging neighbouring ones. returns false
+  // if nothing is left to draw.
+  bool cull_meshlets(const Mesh &mesh, const Frustum &frustum,
+                     const glm::vec3 &camera, DrawStats &stats) {
+    range_counts.clear();
+    range_offsets.clear();
+    range_base_vertices.clear();
+    size_t range_end = ~size_t(0);
+    for (const Meshlet &meshlet : mesh.meshlets) {
+      stats.clusters++;
+      if (!frustum.intersects_sphere(meshlet.center, meshlet.radius) ||
+          meshlet_backfacing(meshlet, camera)) {
+        stats.clusters_culled++;
+        continue;
+      }
+
+      stats.triangles += meshlet.index_count / 3;
+      if (meshlet.index_offset == range_end) {
+        range_counts.back() += meshlet.index_count;
+      } else {
+        range_counts.push_back(meshlet.index_count);
+        range_offsets.push_back(mesh.index_pointer(meshlet.index_offset));
+        range_base_vertices.push_back(mesh.base_vertex);
+      }
+      range_end = meshlet.index_offset + meshlet.index_count;
+    }
+    return !range_counts.empty();
+  }
 
+  // coarsest level whose simplification error, projected at the nearest
+  // point of the mesh's bounding sphere, stays within lod_bias pixels.
+  static size_t select_lod(const Mesh &mesh, const glm::mat4 &model_view,
+                           float scale, const DrawContext &ctx) {
+    if (mesh.lods.size() < 2 || ctx.lod_bias <= 0.0f) {
+      return 0;
+    }
+
+    glm::vec3 center = (mesh.aabb_min + mesh.aabb_max) * 0.5f;
+    float radius = glm::length(mesh.aabb_max - mesh.aabb_min) * 0.5f * scale;
+    float depth = -(model_view * glm::vec4(center, 1.0f)).z - radius;
+    if (depth <= 0.0f) {
+      return 0;
+    }
+
+    float pixels_per_unit =
+      ctx.projection[1][1] * 0.5f * ctx.viewport_height / depth;
+    for (size_t level = mesh.lods.size() - 1; level > 0; level--) {
+      if (mesh.lods[level].error * scale * pixels_per_unit <= ctx.lod_bias) {
+        return level;
+      }
+    }
+    return 0;
+  }
+
+  struct ProcessedMesh {
+    MeshData data;
+    size_t imported_vertices = 0;
+    size_t welded_vertices = 0;
+    VertexCacheStats before;
+    VertexCacheStats after;
+    TriangleBvh triangle_bvh;
+
+    // GLB primitives whose layout matches Vertex stay in the mapped file and
+    // are uploaded from there; `data` then only holds textures, bounds and
+    // widened indices if the file's could not be used.
+    const Vertex *mapped_vertices = nullptr;
+    size_t vertex_count = 0;
+    const void *mapped_indices = nullptr;
+    size_t index_count = 0;
+    uint32_t index_size = 4;
+  };
+
+  // state of an import in flight, shared between the importing thread and
+  // the GL thread. the importer fills it in, then only the GL thread touches
+  // it once `import` is ready.
+  struct PendingLoad {
+    std::string path;
+    std::future<void> import;
+    bool failed = false;
+    std::chrono::steady_clock::time_point start;
+
+    // warm start: views into the mapped cache.
+    MeshCacheReader reader;
+    std::vector<MeshCacheView> views;
+    size_t vertex_bytes = 0;
+    size_t index_bytes = 0;
+
+    // node hierarchy; views carry their own node index.
+    SceneGraph graph;
+
+    // cold start: the scene stays alive until every job has finished.
+    Assimp::Importer importer;
+    ObjScene obj;
+    GltfScene gltf;
+    std::vector<std::future<ProcessedMesh>> jobs;
+    // scene graph node of each job's mesh.
+    std::vector<uint32_t> job_nodes;
+
+    // false for sources the mesh cache cannot represent.
+    bool cacheable = true;
+    // asset cache key of the source and options.
+    uint64_t cache_key = 0;
+    bool imported = false;
+    size_t next = 0;
+    size_t imported_vertices = 0;
+    size_t welded_vertices = 0;
+
+    size_t size() const { return jobs.empty() ? views.size() : jobs.size(); }
+  };
+
+  std::unique_ptr<PendingLoad> pending;
+  size_t meshes_total = 0;
+  LoadState load_state = LoadState::LOADING;
+
+  // reload in progress: a model of its own, swapped in when it is complete.
+  std::unique_ptr<Model> replacement;
+  bool reload_queued = false;
+
+  // GL thread: swaps in the reloaded meshes once nothing reads either set.
+  // the replacement then owns the old meshes and releases them with itself.
+  void finish_reload() {
+    Model &next = *replacement;
+    if (next.load_state == LoadState::LOADING || next.cache_writer.valid() ||
+        pending || cache_writer.valid()) {
+      return;
+    }
+    if (next.load_state == LoadState::FAILED) {
+      fprintf(stderr, "Reload failed, keeping %s\n", source.c_str());
+    } else {
+      arena.swap(next.arena);
+      meshes.swap(next.meshes);
+      std::swap(graph, next.graph);
+      std::swap(bvh, next.bvh);
+      std::swap(mesh_bounds, next.mesh_bounds);
+      std::swap(meshes_total, next.meshes_total);
+      load_state = LoadState::READY;
+      printf("Reloaded %s\n", source.c_str());
+    }
+    replacement.reset();
+    if (reload_queued) {
+      reload_queued = false;
+      reload();
+    }
+  }
+
+  // starts the import on its own thread, which feeds the worker pool.
   void load_model(const std::string &path) {
-    Assimp::Importer import;
-    const aiScene *scene =
-      import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    directory = path.substr(0, path.find_last_of('/'));
+    pending = std::make_unique<PendingLoad>();
+    pending->path = path;
+    pending->start = std::chrono::steady_clock::now();
+    PendingLoad *load = pending.get();
+    load->import =
+      std::async(std::launch::async, [this, load] { import_model(*load); });
+  }
+
+  // importing thread: must not touch GL or the mesh list.
+  void import_model(PendingLoad &load) {
+    {
+      // hashing the source is part of the price of a warm start.
+      ScopedTimer timer(load.path, "cache read");
+      load.cacheable = asset_cache().enabled() &&
+                       !has_extension(load.path, ".glb") &&
+                       source_key(load.path, load.cache_key);
+      if (load.cacheable && open_cache(load)) {
+        return;
+      }
+    }
+    if (has_extension(load.path, ".obj") && import_obj(load)) {
+      return;
+    }
+    if (has_extension(load.path, ".glb") && import_glb(load)) {
+      return;
+    }
+
+    const aiScene *scene;
+    {
+      ScopedTimer timer(load.path, "parse");
+      scene = load.importer.ReadFile(load.path,
+                                     aiProcess_Triangulate | aiProcess_FlipUVs);
+    }
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
         !scene->mRootNode) {
-      fprintf(stderr, "Failed to load model: %s\n", import.GetErrorString());
+      fprintf(stderr, "Failed to load model: %s\n",
+              load.importer.GetErrorString());
+      load.failed = true;
       return;
     }
-    directory = path.substr(0, path.find_last_of('/'));
 
-    process_node(scene->mRootNode, scene);
+    // convert meshes on the worker pool; the GL thread uploads them in node
+    // order, so draw order matches a serial load.
+    std::vector<aiMesh *> scene_meshes;
+    collect_meshes(scene->mRootNode, scene, SceneGraph::NO_PARENT,
+                   load.graph, scene_meshes, load.job_nodes);
+
+    load.jobs.reserve(scene_meshes.size());
+    for (aiMesh *mesh : scene_meshes) {
+      load.jobs.push_back(worker_pool().submit([this, mesh, scene] {
+        ProcessedMesh result;
+        {
+          ScopedTimer timer(source, "convert");
+          result.data = process_mesh(mesh, scene);
+        }
+        prepare_mesh(result);
+        return result;
+      }));
+    }
+  }
+
+  static bool has_extension(const std::string &path, const char *extension) {
+    size_t n = std::strlen(extension);
+    if (path.size() < n) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (std::tolower((unsigned char)path[path.size() - n + i]) !=
+          extension[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Wavefront files skip assimp; see obj_loader.hpp.
+  bool import_obj(PendingLoad &load) {
+    {
+      ScopedTimer timer(load.path, "parse");
+      if (!load_obj(load.path, load.obj)) {
+        return false;
+      }
+    }
+
+    // OBJ has no hierarchy: every group hangs off one identity node.
+    load.graph.add_node(SceneGraph::NO_PARENT, glm::mat4(1.0f));
+    const ObjScene *scene = &load.obj;
+    load.job_nodes.assign(scene->groups.size(), 0);
+    load.jobs.reserve(scene->groups.size());
+    for (const ObjGroup &group : scene->groups) {
+      // start every decode before the first upload waits on one.
+      std::vector<TextureRef> textures = obj_textures(*scene, group.material);
+      load.jobs.push_back(worker_pool().submit(
+        [this, scene, &group, textures = std::move(textures)]() mutable {
+          ProcessedMesh result;
+          {
+            ScopedTimer timer(source, "convert");
+            result.data = obj_mesh_data(*scene, group);
+          }
+          result.data.textures = std::move(textures);
+          prepare_mesh(result);
+          return result;
+        }));
+    }
+    return true;
+  }
+
+  // GLB files skip assimp; see gltf_loader.hpp. nothing is written to the
+  // mesh cache: mapped primitives have no host copy to write, and the GLB is
+  // already laid out for upload.
+  bool import_glb(PendingLoad &load) {
+    {
+      ScopedTimer timer(load.path, "parse");
+      if (!load_glb(load.path, load.gltf)) {
+        return false;
+      }
+    }
+    load.cacheable = false;
+    load.graph = std::move(load.gltf.graph);
+
+    const GltfScene *scene = &load.gltf;
+    load.jobs.reserve(scene->primitives.size());
+    for (const GltfPrimitive &primitive : scene->primitives) {
+      std::vector<TextureRef> textures = gltf_textures(*scene, primitive);
+      load.job_nodes.push_back(primitive.node);
+      load.jobs.push_back(worker_pool().submit(
+        [this, scene, &primitive, textures = std::move(textures)]() mutable {
+          ProcessedMesh result;
+          result.data.textures = std::move(textures);
+          if (map_primitive(*scene, primitive, result)) {
+            build_triangle_bvh(result);
+            return result;
+          }
+          bool converted;
+          {
+            ScopedTimer timer(source, "convert");
+            converted = gltf_mesh_data(*scene, primitive, result.data);
+          }
+          if (!converted) {
+            // an empty mesh keeps the job list in step with the nodes.
+            fprintf(stderr, "Skipping malformed glTF primitive in %s\n",
+                    source.c_str());
+            result.data.vertices.clear();
+            result.data.indices.clear();
+            result.data.lods = {{0, 0, 0.0f}};
+            return result;
+          }
+          prepare_mesh(result);
+          return result;
+        }));
+    }
+    return true;
+  }
+
+  // points `result` at the primitive's geometry in the mapped file if its
+  // vertices can be used as they are.
+  static bool map_primitive(const GltfScene &scene,
+                            const GltfPrimitive &primitive,
+                            ProcessedMesh &result) {
+    MeshData &data = result.data;
+    if (!gltf_direct_vertices(scene, primitive, result.mapped_vertices,
+                              result.vertex_count)) {
+      return false;
+    }
+    if (!gltf_direct_indices(scene, primitive, result.vertex_count,
+                             result.mapped_indices, result.index_count,
+                             result.index_size)) {
+      if (!gltf_read_indices(scene, primitive, result.vertex_count,
+                             data.indices)) {
+        result.mapped_vertices = nullptr;
+        return false;
+      }
+      result.mapped_indices = data.indices.data();
+      result.index_count = data.indices.size();
+      result.index_size = 4;
+    }
+
+    const Vertex *vertices = result.mapped_vertices;
+    if (result.vertex_count > 0) {
+      data.aabb_min = data.aabb_max = vertices[0].position;
+    }
+    for (size_t i = 0; i < result.vertex_count; i++) {
+      data.aabb_min = glm::min(data.aabb_min, vertices[i].position);
+      data.aabb_max = glm::max(data.aabb_max, vertices[i].position);
+    }
+    return true;
+  }
+
+  // base color as the diffuse map; glTF has no specular map.
+  std::vector<TextureRef> gltf_textures(const GltfScene &scene,
+                                        const GltfPrimitive &primitive) const {
+    std::vector<TextureRef> refs;
+    int64_t image = gltf_base_color_image(scene, primitive);
+    if (image >= 0) {
+      std::string key = gltf_image_key(source, image);
+      texture_registry().prefetch(
+        key, gltf_image_decoder(scene, image, directory, key),
+        TextureType::DIFFUSE);
+      refs.push_back({TextureType::DIFFUSE, key});
+    }
+    refs.push_back({TextureType::SPECULAR, ""});
+    return refs;
+  }
+
+  // the same texture list process_mesh builds from an assimp material.
+  std::vector<TextureRef> obj_textures(const ObjScene &scene,
+                                       uint32_t material) const {
+    std::vector<TextureRef> refs;
+    const ObjMaterial *mat = material != ObjGroup::NO_MATERIAL
+                               ? &scene.materials[material]
+                               : nullptr;
+    if (mat && !mat->diffuse_map.empty()) {
+      std::string path = directory + "/" + mat->diffuse_map;
+      texture_registry().prefetch(path, TextureType::DIFFUSE);
+      refs.push_back({TextureType::DIFFUSE, path});
+    }
+    if (mat && !mat->specular_map.empty()) {
+      std::string path = directory + "/" + mat->specular_map;
+      texture_registry().prefetch(path, TextureType::SPECULAR);
+      refs.push_back({TextureType::SPECULAR, path});
+    } else {
+      refs.push_back({TextureType::SPECULAR, ""});
+    }
+    return refs;
+  }
+
+  // import options that change what ends up in the mesh cache.
+  std::string cache_flags() const {
+    char flags[96];
+    snprintf(flags, sizeof(flags), "weld=%d tolerance=%a,%a,%a bvh=%d",
+             options.weld_vertices, options.weld_tolerance.position,
+             options.weld_tolerance.normal, options.weld_tolerance.tex_coord,
+             options.triangle_bvh);
+    return flags;
+  }
+
+  // asset cache key of the source and, for OBJ files, of the material
+  // libraries it names: cached meshes hold the materials' texture paths, so
+  // an edited .mtl must miss too. False if the source cannot be read.
+  bool source_key(const std::string &path, uint64_t &key) const {
+    MappedFile file;
+    if (!file.open(path)) {
+      return false;
+    }
+    key = AssetCache::bytes_key(file.data(), file.size(), "mesh",
+                                MESH_CACHE_VERSION, cache_flags());
+    if (!has_extension(path, ".obj")) {
+      return true;
+    }
+    const char *text = reinterpret_cast<const char *>(file.data());
+    std::string dir = path.substr(0, path.find_last_of('/'));
+    Hasher64 hasher(key);
+    for (const std::string &library :
+         obj_material_libraries(text, text + file.size())) {
+      hasher.update(library.c_str(), library.size() + 1);
+      // a missing library hashes differently from an empty one.
+      MappedFile mtl;
+      uint64_t size = mtl.open(dir + "/" + library) ? mtl.size() : ~0ull;
+      hasher.update_value(size);
+      if (size != ~0ull) {
+        hasher.update(mtl.data(), mtl.size());
+      }
+    }
+    key = hasher.digest();
+    return true;
+  }
+
+  // warm start: geometry goes from the mapped cache straight into GL buffers,
+  // assimp is never touched.
+  bool open_cache(PendingLoad &load) {
+    std::string cache_path = asset_cache().find(load.cache_key, "mesh");
+    if (cache_path.empty() || !load.reader.open(cache_path, load.cache_key)) {
+      return false;
+    }
+    load.graph = load.reader.scene_graph();
+    auto corrupt = [&] {
+      fprintf(stderr, "Corrupt mesh cache: %s\n", cache_path.c_str());
+      load.views.clear();
+      load.graph = SceneGraph();
+      return false;
+    };
+
+    load.views.resize(load.reader.meshes_left());
+    for (auto &view : load.views) {
+      if (!load.reader.next(view)) {
+        return corrupt();
+      }
+      // start every decode before the first upload waits on one.
+      for (const TextureRef &ref : view.textures) {
+        if (!ref.path.empty()) {
+          texture_registry().prefetch(ref.path, ref.type);
+        }
+      }
+    }
+
+    // meshes decode independently on the pool; this thread only waits.
+    std::vector<std::future<bool>> decodes;
+    decodes.reserve(load.views.size());
+    for (auto &view : load.views) {
+      decodes.push_back(worker_pool().submit([this, &view] {
+        ScopedTimer timer(source, "decode");
+        return view.decode();
+      }));
+    }
+    bool decoded = true;
+    for (auto &decode : decodes) {
+      decoded = decode.get() && decoded;
+    }
+    if (!decoded) {
+      return corrupt();
+    }
+
+    // sizes are known up front, so the arena is allocated once.
+    for (const auto &view : load.views) {
+      size_t stride = GeometryArena::stride(resolve_vertex_format(
+        options.vertex_format, view.vertices, view.vertex_count));
+      // plus worst-case alignment padding in front of each mesh.
+      load.vertex_bytes += (view.vertex_count + 1) * stride;
+      load.index_bytes += (size_t)view.index_count * view.index_size + 4;
+    }
+    return true;
   }
 
-  void process_node(aiNode *node, const aiScene *scene) {
+  // GL thread: creates meshes whose data has arrived, in order, until the
+  // budget is spent. textures still decoding show placeholders meanwhile.
+  void upload_pending(double budget_seconds) {
+    PendingLoad &load = *pending;
+    if (!load.imported) {
+      if (load.import.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        return;
+      }
+      load.import.get();
+      load.imported = true;
+      if (load.failed) {
+        load_state = LoadState::FAILED;
+        pending.reset();
+        return;
+      }
+      meshes_total = load.size();
+      meshes.reserve(meshes_total);
+      graph = std::move(load.graph);
+      arena.reserve(load.vertex_bytes, load.index_bytes);
+      if (!load.jobs.empty()) {
+        printf("Vertex cache optimization for %s:\n", load.path.c_str());
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&] {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start)
+        .count();
+    };
+    while (load.next < meshes_total && elapsed() < budget_seconds) {
+      if (load.jobs.empty()) {
+        MeshCacheView &view = load.views[load.next];
+        std::vector<Texture> textures = resolve_textures(view.textures);
+        ScopedTimer timer(load.path, "upload");
+        meshes.emplace_back(arena, view.vertices, view.vertex_count,
+                            view.indices, view.index_count, view.index_size,
+                            std::move(textures), view.lods,
+                            view.meshlets, view.aabb_min, view.aabb_max,
+                            options.vertex_format);
+        meshes.back().node = view.node;
+        meshes.back().triangle_bvh = std::move(view.triangle_bvh);
+        retain_mapped(meshes.back(), view.vertices, view.indices,
+                      view.index_size);
+        // frees the decoded copy, if any.
+        view = MeshCacheView();
+        load.next++;
+        continue;
+      }
+
+      std::future<ProcessedMesh> &job = load.jobs[load.next];
+      if (job.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        break;
+      }
+      ProcessedMesh result = job.get();
+      if (result.mapped_vertices) {
+        std::vector<Texture> textures = resolve_textures(result.data.textures);
+        {
+          // full floats: packing would need a copy of every vertex.
+          ScopedTimer timer(load.path, "upload");
+          meshes.emplace_back(arena, result.mapped_vertices,
+                              result.vertex_count, result.mapped_indices,
+                              result.index_count, result.index_size,
+                              std::move(textures), std::vector<MeshLod>(),
+                              std::vector<Meshlet>(), result.data.aabb_min,
+                              result.data.aabb_max, VertexFormat::FLOAT);
+        }
+        meshes.back().node = load.job_nodes[load.next];
+        meshes.back().triangle_bvh = std::move(result.triangle_bvh);
+        retain_mapped(meshes.back(), result.mapped_vertices,
+                      result.mapped_indices, result.index_size);
+        load.next++;
+        continue;
+      }
+      printf("  mesh %3zu: %7u tris  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f  "
+             "%zu lods\n",
+             load.next, result.data.lods[0].index_count / 3,
+             result.before.acmr, result.after.acmr, result.before.atvr,
+             result.after.atvr, result.data.lods.size());
+      load.imported_vertices += result.imported_vertices;
+      load.welded_vertices += result.welded_vertices;
+      std::vector<Texture> textures = resolve_textures(result.data.textures);
+      {
+        ScopedTimer timer(load.path, "upload");
+        meshes.emplace_back(arena, std::move(result.data),
+                            std::move(textures), options.vertex_format);
+      }
+      meshes.back().node = load.job_nodes[load.next];
+      meshes.back().triangle_bvh = std::move(result.triangle_bvh);
+      load.next++;
+    }
+    if (load.next < meshes_total) {
+      return;
+    }
+
+    // a cached tree only needs its boxes brought up to date.
+    graph.update();
+    update_mesh_bounds();
+    if (!load.reader.mesh_bvh().empty()) {
+      bvh = load.reader.mesh_bvh();
+      bvh.refit(mesh_bounds);
+    } else {
+      bvh.build(mesh_bounds, 1);
+    }
+
+    // the meshes are final from here on, so the cache can be written while
+    // they are drawn.
+    if (!load.jobs.empty()) {
+      if (load.imported_vertices > 0) {
+        printf("Welded %s: %zu -> %zu vertices (-%.1f%%)\n", load.path.c_str(),
+               load.imported_vertices, load.welded_vertices,
+               100.0 * (load.imported_vertices - load.welded_vertices) /
+                 load.imported_vertices);
+      }
+      if (load.cacheable) {
+        std::string path = load.path;
+        uint64_t key = load.cache_key;
+        // a copy, since the app may animate the graph while this runs.
+        cache_writer = std::async(std::launch::async, [this, path, key,
+                                                       nodes = graph,
+                                                       tree = bvh] {
+          ScopedTimer timer(path, "cache write");
+          bool stored = asset_cache().store(
+            key, "mesh", [&](const std::string &tmp_path) {
+              return write_mesh_cache(tmp_path, key, meshes, nodes, tree);
+            });
+          if (!stored) {
+            fprintf(stderr, "Failed to write mesh cache for %s\n",
+                    path.c_str());
+          }
+        });
+      } else {
+        for (Mesh &mesh : meshes) {
+          mesh.retain(options.retention);
+        }
+      }
+    }
+    std::chrono::duration<double> total =
+      std::chrono::steady_clock::now() - load.start;
+    load_profiler().record(load.path, "total", total.count());
+    load_state = LoadState::READY;
+    pending.reset();
+  }
+
+  // meshes uploaded from a mapping keep a host copy only if the policy asks
+  // for one; the mapping goes away with the load.
+  void retain_mapped(Mesh &mesh, const Vertex *vertices, const void *indices,
+                     uint32_t index_size) const {
+    if (options.retention != GeometryRetention::DISCARD) {
+      mesh.copy_geometry(vertices, indices, index_size);
+      mesh.retain(options.retention);
+    }
+  }
+
+  // worker threads: welding, then the optimization passes.
+  void prepare_mesh(ProcessedMesh &mesh) const {
+    MeshData &data = mesh.data;
+    mesh.imported_vertices = data.vertices.size();
+    {
+      // per-corner imports such as OBJ share no vertices until welded, and
+      // reordering for the vertex cache gains nothing without them.
+      ScopedTimer timer(source, "weld");
+      weld_vertices(data.vertices, data.indices,
+                    options.weld_vertices ? options.weld_tolerance
+                                          : WeldTolerance());
+    }
+    mesh.welded_vertices = data.vertices.size();
+    {
+      ScopedTimer timer(source, "optimize");
+      optimize_mesh(mesh);
+    }
+    build_triangle_bvh(mesh);
+  }
+
+  // worker threads, on the final vertex and index order.
+  void build_triangle_bvh(ProcessedMesh &mesh) const {
+    if (!options.triangle_bvh) {
+      return;
+    }
+    ScopedTimer timer(source, "bvh");
+    if (mesh.mapped_vertices) {
+      mesh.triangle_bvh = TriangleBvh::build(
+        mesh.mapped_vertices, mesh.vertex_count, mesh.mapped_indices,
+        mesh.index_count, mesh.index_size);
+      return;
+    }
+    const MeshData &data = mesh.data;
+    mesh.triangle_bvh = TriangleBvh::build(
+      data.vertices.data(), data.vertices.size(), data.indices.data(),
+      data.lods[0].index_count, sizeof(unsigned int));
+  }
+
+  // bounds of every mesh in model space, from the current world transforms.
+  Aabb model_bounds() const {
+    if (!bvh.empty()) {
+      return Aabb{bvh.nodes[0].min, bvh.nodes[0].max};
+    }
+    Aabb bounds;
+    for (const Mesh &mesh : meshes) {
+      bounds.grow(
+        Aabb{mesh.aabb_min, mesh.aabb_max}.transformed(graph.world(mesh.node)));
+    }
+    return bounds;
+  }
+
+  void update_mesh_bounds() {
+    mesh_bounds.resize(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++) {
+      const Mesh &mesh = meshes[i];
+      mesh_bounds[i] = Aabb{mesh.aabb_min, mesh.aabb_max}.transformed(
+        graph.world(mesh.node));
+    }
+  }
+
+  // triangle order for the post-transform cache, then cluster order against
+  // overdraw, then vertex order for fetch locality.
+  static void optimize_mesh(ProcessedMesh &mesh) {
+    MeshData &data = mesh.data;
+    mesh.before = analyze_vertex_cache(data.indices, data.vertices.size());
+    optimize_vertex_cache(data.indices, data.vertices.size());
+    optimize_overdraw(data.indices, data.vertices);
+    optimize_vertex_fetch(data.vertices, data.indices);
+    mesh.after = analyze_vertex_cache(data.indices, data.vertices.size());
+    build_lods(data);
+    data.meshlets = build_meshlets(data.indices, data.vertices, 0,
+                                   data.lods[0].index_count);
+  }
+
+  // appends up to MAX_LODS - 1 coarser levels, each simplified from the
+  // previous one to about half its triangles. stops once a level no longer
+  // pays for itself.
+  static void build_lods(MeshData &data) {
+    data.lods = {{0, (uint32_t)data.indices.size(), 0.0f}};
+    float max_error = glm::length(data.aabb_max - data.aabb_min) * 0.05f;
+
+    std::vector<unsigned int> level = data.indices;
+    float error = 0.0f;
+    while (data.lods.size() < MAX_LODS) {
+      size_t target = level.size() / 6 * 3;
+      float level_error;
+      std::vector<unsigned int> next = simplify_mesh(
+        level, data.vertices, target, max_error - error, &level_error);
+      if (next.empty() || next.size() > level.size() * 9 / 10) {
+        break;
+      }
+
+      optimize_vertex_cache(next, data.vertices.size());
+      error += level_error;
+      data.lods.push_back(
+        {(uint32_t)data.indices.size(), (uint32_t)next.size(), error});
+      data.indices.insert(data.indices.end(), next.begin(), next.end());
+      level = std::move(next);
+    }
+  }
+
+  // flattens the node tree depth first into `graph`, so parents precede
+  // their children and the meshes of a node stay adjacent.
+  static void collect_meshes(const aiNode *node, const aiScene *scene,
+                             uint32_t parent, SceneGraph &graph,
+                             std::vector<aiMesh *> &out,
+                             std::vector<uint32_t> &out_nodes) {
+    uint32_t index = graph.add_node(parent, to_mat4(node->mTransformation));
     for (size_t i = 0; i < node->mNumMeshes; i++) {
-      aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-      meshes.push_back(process_mesh(mesh, scene));
+      out.push_back(scene->mMeshes[node->mMeshes[i]]);
+      out_nodes.push_back(index);
     }
 
     for (size_t i = 0; i < node->mNumChildren; i++) {
-      process_node(node->mChildren[i], scene);
+      collect_meshes(node->mChildren[i], scene, index, graph, out, out_nodes);
     }
   }
 
-  Mesh process_mesh(aiMesh *mesh, const aiScene *scene) {
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
-    std::vector<Texture> textures;
+  // assimp matrices are row-major, glm's column-major.
+  static glm::mat4 to_mat4(const aiMatrix4x4 &m) {
+    glm::mat4 out;
+    for (int row = 0; row < 4; row++) {
+      for (int col = 0; col < 4; col++) {
+        out[col][row] = m[row][col];
+      }
+    }
+    return out;
+  }
+
+  // runs on worker threads: must not touch GL or mutable Model state.
+  MeshData process_mesh(const aiMesh *mesh, const aiScene *scene) const {
+    MeshData data;
+    data.vertices.reserve(mesh->mNumVertices);
+    data.indices.reserve(mesh->mNumFaces * 3);
 
     for (size_t i = 0; i < mesh->mNumVertices; i++) {
       Vertex vertex;
@@ -87,61 +1257,51 @@ private:
         vertex.tex_coords = glm::vec2(0.0f, 0.0f);
       }
 
-      vertices.push_back(vertex);
+      data.vertices.push_back(vertex);
     }
 
     for (size_t i = 0; i < mesh->mNumFaces; i++) {
       aiFace face = mesh->mFaces[i];
       for (size_t j = 0; j < face.mNumIndices; j++) {
-        indices.push_back(face.mIndices[j]);
+        data.indices.push_back(face.mIndices[j]);
       }
     }
 
-    if (mesh->mMaterialIndex >= 0) {
-      aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-      std::vector<Texture> diffuse_maps = load_material_textures(
-        material, aiTextureType_DIFFUSE, TextureType::DIFFUSE);
-      textures.insert(textures.end(), diffuse_maps.begin(), diffuse_maps.end());
-      std::vector<Texture> specular_maps = load_material_textures(
-        material, aiTextureType_SPECULAR, TextureType::SPECULAR);
-      if (specular_maps.empty()) {
-        unsigned char black[] = {0, 0, 0, 255};
-        unsigned int default_specular_map;
-        glGenTextures(1, &default_specular_map);
-        glBindTexture(GL_TEXTURE_2D, default_specular_map);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA,
-                     GL_UNSIGNED_BYTE, black);
-        specular_maps.push_back(
-          Texture(default_specular_map, TextureType::SPECULAR));
-      }
-      textures.insert(textures.end(), specular_maps.begin(),
-                      specular_maps.end());
+    const aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+    material_textures(material, aiTextureType_DIFFUSE, TextureType::DIFFUSE,
+                      data.textures);
+    size_t n_textures = data.textures.size();
+    material_textures(material, aiTextureType_SPECULAR, TextureType::SPECULAR,
+                      data.textures);
+    if (data.textures.size() == n_textures) {
+      data.textures.push_back({TextureType::SPECULAR, ""});
     }
 
-    return Mesh(vertices, indices, textures);
+    data.compute_bounds();
+    return data;
   }
 
-  std::vector<Texture> load_material_textures(aiMaterial *mat,
-                                              aiTextureType type,
-                                              TextureType texture_type) {
-    std::vector<Texture> textures;
+  void material_textures(const aiMaterial *mat, aiTextureType type,
+                         TextureType texture_type,
+                         std::vector<TextureRef> &out) const {
     for (size_t i = 0; i < mat->GetTextureCount(type); i++) {
       aiString str;
       mat->GetTexture(type, i, &str);
       std::string path = directory + "/" + str.C_Str();
-      bool skip = false;
-      for (size_t j = 0; j < textures_loaded.size(); j++) {
-        if (std::strcmp(textures_loaded[j].path.c_str(), path.c_str()) == 0) {
-          textures.push_back(textures_loaded[j]);
-          skip = true;
-          break;
-        }
-      }
-      if (!skip) {
-        auto texture = Texture(path.c_str(), texture_type);
-        textures.push_back(texture);
-        textures_loaded.push_back(texture);
-      }
+      texture_registry().prefetch(path, texture_type);
+      out.push_back({texture_type, path});
+    }
+  }
+
+  std::vector<Texture> resolve_textures(const std::vector<TextureRef> &refs) {
+    std::vector<Texture> textures;
+    textures.reserve(refs.size());
+    for (const TextureRef &ref : refs) {
+      // an empty path is a material without that map, e.g. the black
+      // specular map of materials without a specular texture.
+      textures.push_back(ref.path.empty()
+                           ? texture_registry().acquire_default(ref.type)
+                           : texture_registry().acquire(ref.path, ref.type));
     }
     return textures;
   }
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free queue for many producers and a single consumer.
+//
+// Producers push onto an atomic singly linked stack with one CAS. The
+// consumer takes the whole stack with one exchange and reverses it into a
+// list only it touches, so items come out in push order per producer and
+// the consumer never races a producer on the same node (no ABA).
+template <typename T> class MpscQueue {
+public:
+  MpscQueue() = default;
+
+  ~MpscQueue() {
+    T discard;
+    while (pop(discard)) {
+    }
+  }
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  // Any thread.
+  void push(T value) {
+    Node *node = new Node{std::move(value), nullptr};
+    node->next = incoming.load(std::memory_order_relaxed);
+    while (!incoming.compare_exchange_weak(node->next, node,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    }
+  }
+
+  // Consumer thread only. False if the queue is empty.
+  bool pop(T &out) {
+    if (!outgoing) {
+      Node *stack = incoming.exchange(nullptr, std::memory_order_acquire);
+      while (stack) {
+        Node *next = stack->next;
+        stack->next = outgoing;
+        outgoing = stack;
+        stack = next;
+      }
+      if (!outgoing) {
+        return false;
+      }
+    }
+    Node *node = outgoing;
+    outgoing = node->next;
+    out = std::move(node->value);
+    delete node;
+    return true;
+  }
+
+private:
+  struct Node {
+    T value;
+    Node *next;
+  };
+
+  // pushed, newest first.
+  std::atomic<Node *> incoming{nullptr};
+  // taken by the consumer, oldest first.
+  Node *outgoing = nullptr;
+};
@@ -0,0 +1,540 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "thread_pool.hpp"
+
+// Wavefront OBJ/MTL reader for the formats our assets use, bypassing Assimp.
+//
+// The file is memory-mapped and cut into chunks at line boundaries that are
+// parsed in parallel. Each chunk keeps its own attribute arrays and faces;
+// they are concatenated afterwards, when the global index of every chunk's
+// first attribute is known and relative (negative) indices can be resolved.
+//
+// Output matches Assimp with aiProcess_Triangulate | aiProcess_FlipUVs:
+// polygons are fan-triangulated, v is flipped, and a new mesh starts at
+// every o/g/usemtl statement. Unlike Assimp, corners with identical
+// v/vt/vn triples share a vertex.
+
+struct ObjMaterial {
+  std::string name;
+  std::string diffuse_map;  // map_Kd, relative to the model directory
+  std::string specular_map; // map_Ks
+};
+
+// v/vt/vn indices of a triangle corner, 0-based. -1 marks a missing vt/vn.
+struct ObjCorner {
+  int32_t v;
+  int32_t vt;
+  int32_t vn;
+};
+
+// consecutive triangles sharing a material.
+struct ObjGroup {
+  static constexpr uint32_t NO_MATERIAL = ~0u;
+  uint32_t material;
+  size_t corner_begin;
+  size_t corner_end;
+};
+
+struct ObjScene {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> tex_coords;
+  std::vector<glm::vec3> normals;
+  std::vector<ObjCorner> corners;
+  std::vector<ObjGroup> groups;
+  std::vector<ObjMaterial> materials;
+};
+
+namespace detail {
+
+constexpr int32_t OBJ_MISSING = -1;
+
+inline bool obj_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline bool obj_digit(char c) { return c >= '0' && c <= '9'; }
+
+inline const char *obj_skip_space(const char *p, const char *end) {
+  while (p < end && obj_space(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// decimal float without locale or errno overhead. digits past the 19th
+// no longer fit the mantissa and only shift the exponent.
+inline const char *obj_parse_float(const char *p, const char *end,
+                                   float &out) {
+  static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+  p = obj_skip_space(p, end);
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  for (; p < end && obj_digit(*p); p++) {
+    if (digits < 19) {
+      digits += mantissa != 0 || *p != '0';
+      mantissa = mantissa * 10 + (*p - '0');
+    } else {
+      exponent++;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && obj_digit(*p); p++) {
+      if (digits < 19) {
+        digits += mantissa != 0 || *p != '0';
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    bool negative_exponent = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      negative_exponent = *p == '-';
+      p++;
+    }
+    int e = 0;
+    for (; p < end && obj_digit(*p); p++) {
+      e = std::min(e * 10 + (*p - '0'), 10000);
+    }
+    exponent += negative_exponent ? -e : e;
+  }
+
+  double value = (double)mantissa;
+  if (mantissa != 0 && exponent != 0) {
+    int magnitude = std::abs(exponent);
+    double scale =
+      magnitude <= 22 ? powers[magnitude] : std::pow(10.0, magnitude);
+    value = exponent < 0 ? value / scale : value * scale;
+  }
+  out = (float)(negative ? -value : value);
+  return p;
+}
+
+inline const char *obj_parse_int(const char *p, const char *end,
+                                 int32_t &out) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  int64_t value = 0;
+  for (; p < end && obj_digit(*p); p++) {
+    value = std::min<int64_t>(value * 10 + (*p - '0'), INT32_MAX);
+  }
+  out = (int32_t)(negative ? -value : value);
+  return p;
+}
+
+// rest of the line without surrounding whitespace.
+inline std::string obj_rest(const char *p, const char *end) {
+  p = obj_skip_space(p, end);
+  while (end > p && obj_space(end[-1])) {
+    end--;
+  }
+  return std::string(p, end);
+}
+
+// o/g/usemtl statements, positioned in the corner stream.
+struct ObjEvent {
+  enum Kind { GROUP, MATERIAL } kind;
+  size_t corner;
+  std::string name;
+};
+
+struct ObjChunk {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> tex_coords;
+  std::vector<glm::vec3> normals;
+  std::vector<ObjCorner> corners;
+  std::vector<ObjEvent> events;
+  std::vector<std::string> material_libraries;
+  // corner * 3 + component of indices relative to the chunk's own first
+  // attribute, fixed up once the chunks are concatenated.
+  std::vector<size_t> relative;
+};
+
+inline void obj_parse_chunk(const char *p, const char *end, ObjChunk &chunk) {
+  // corners of the current face, and the relative fixups of those as
+  // polygon slots; reused from face to face.
+  std::vector<ObjCorner> polygon;
+  std::vector<size_t> relative_slots;
+
+  while (p < end) {
+    const char *line_end =
+      static_cast<const char *>(std::memchr(p, '\n', end - p));
+    if (!line_end) {
+      line_end = end;
+    }
+    p = obj_skip_space(p, line_end);
+
+    if (p + 1 < line_end && p[0] == 'v' && obj_space(p[1])) {
+      glm::vec3 v;
+      p = obj_parse_float(p + 1, line_end, v.x);
+      p = obj_parse_float(p, line_end, v.y);
+      obj_parse_float(p, line_end, v.z);
+      chunk.positions.push_back(v);
+    } else if (p + 2 < line_end && p[0] == 'v' && p[1] == 't' &&
+               obj_space(p[2])) {
+      glm::vec2 t(0.0f);
+      p = obj_parse_float(p + 2, line_end, t.x);
+      obj_parse_float(p, line_end, t.y);
+      // aiProcess_FlipUVs
+      t.y = 1.0f - t.y;
+      chunk.tex_coords.push_back(t);
+    } else if (p + 2 < line_end && p[0] == 'v' && p[1] == 'n' &&
+               obj_space(p[2])) {
+      glm::vec3 n;
+      p = obj_parse_float(p + 2, line_end, n.x);
+      p = obj_parse_float(p, line_end, n.y);
+      obj_parse_float(p, line_end, n.z);
+      chunk.normals.push_back(n);
+    } else if (p + 1 < line_end && p[0] == 'f' && obj_space(p[1])) {
+      polygon.clear();
+      relative_slots.clear();
+      p++;
+      for (;;) {
+        p = obj_skip_space(p, line_end);
+        if (p >= line_end || !(obj_digit(*p) || *p == '-' || *p == '+')) {
+          break;
+        }
+        int32_t index[3] = {0, 0, 0};
+        p = obj_parse_int(p, line_end, index[0]);
+        if (p < line_end && *p == '/') {
+          p++;
+          if (p < line_end && *p != '/') {
+            p = obj_parse_int(p, line_end, index[1]);
+          }
+          if (p < line_end && *p == '/') {
+            p = obj_parse_int(p + 1, line_end, index[2]);
+          }
+        }
+        while (p < line_end && !obj_space(*p)) {
+          p++;
+        }
+
+        const size_t counts[3] = {chunk.positions.size(),
+                                  chunk.tex_coords.size(),
+                                  chunk.normals.size()};
+        int32_t resolved[3];
+        for (int k = 0; k < 3; k++) {
+          if (index[k] > 0) {
+            resolved[k] = index[k] - 1;
+          } else if (index[k] < 0) {
+            // relative to the attributes defined so far in this chunk.
+            resolved[k] = (int32_t)counts[k] + index[k];
+            relative_slots.push_back(polygon.size() * 3 + k);
+          } else {
+            resolved[k] = OBJ_MISSING;
+          }
+        }
+        polygon.push_back({resolved[0], resolved[1], resolved[2]});
+      }
+
+      // fan triangulation, as aiProcess_Triangulate does for convex faces.
+      for (size_t i = 2; i < polygon.size(); i++) {
+        const size_t corners[3] = {0, i - 1, i};
+        for (size_t c : corners) {
+          for (size_t slot : relative_slots) {
+            if (slot / 3 == c) {
+              chunk.relative.push_back(chunk.corners.size() * 3 + slot % 3);
+            }
+          }
+          chunk.corners.push_back(polygon[c]);
+        }
+      }
+    } else if (p + 1 < line_end && (p[0] == 'o' || p[0] == 'g') &&
+               obj_space(p[1])) {
+      chunk.events.push_back({ObjEvent::GROUP, chunk.corners.size(),
+                              obj_rest(p + 1, line_end)});
+    } else if (line_end - p > 7 && std::memcmp(p, "usemtl", 6) == 0 &&
+               obj_space(p[6])) {
+      chunk.events.push_back({ObjEvent::MATERIAL, chunk.corners.size(),
+                              obj_rest(p + 6, line_end)});
+    } else if (line_end - p > 7 && std::memcmp(p, "mtllib", 6) == 0 &&
+               obj_space(p[6])) {
+      chunk.material_libraries.push_back(obj_rest(p + 6, line_end));
+    }
+
+    p = line_end < end ? line_end + 1 : end;
+  }
+}
+
+inline bool obj_keyword(const char *p, const char *end, const char *word) {
+  size_t n = std::strlen(word);
+  return (size_t)(end - p) > n && std::memcmp(p, word, n) == 0 &&
+         obj_space(p[n]);
+}
+
+inline bool obj_parse_mtl(const std::string &path,
+                          std::vector<ObjMaterial> &materials) {
+  MappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  const char *p = reinterpret_cast<const char *>(file.data());
+  const char *end = p + file.size();
+  while (p < end) {
+    const char *line_end =
+      static_cast<const char *>(std::memchr(p, '\n', end - p));
+    if (!line_end) {
+      line_end = end;
+    }
+    p = obj_skip_space(p, line_end);
+
+    if (obj_keyword(p, line_end, "newmtl")) {
+      materials.push_back({obj_rest(p + 6, line_end), "", ""});
+    } else if (!materials.empty() && (obj_keyword(p, line_end, "map_Kd") ||
+                                      obj_keyword(p, line_end, "map_Ks"))) {
+      // options such as -bm come first; the file name is the last token.
+      std::string value = obj_rest(p + 6, line_end);
+      size_t space = value.find_last_of(" \t");
+      if (space != std::string::npos) {
+        value = value.substr(space + 1);
+      }
+      (p[5] == 'd' ? materials.back().diffuse_map
+                   : materials.back().specular_map) = value;
+    }
+    p = line_end < end ? line_end + 1 : end;
+  }
+  return true;
+}
+
+} // namespace detail
+
+// names in the mtllib statements of OBJ text, without parsing the rest.
+inline std::vector<std::string> obj_material_libraries(const char *p,
+                                                       const char *end) {
+  std::vector<std::string> libraries;
+  while (p < end) {
+    const char *line_end = (const char *)std::memchr(p, '\n', end - p);
+    if (!line_end) {
+      line_end = end;
+    }
+    p = detail::obj_skip_space(p, line_end);
+    if (detail::obj_keyword(p, line_end, "mtllib")) {
+      libraries.push_back(detail::obj_rest(p + 6, line_end));
+    }
+    p = line_end < end ? line_end + 1 : end;
+  }
+  return libraries;
+}
+
+// Parses `path` and the material libraries it references. Call from a
+// thread that is not part of the worker pool, which parses the chunks.
+inline bool load_obj(const std::string &path, ObjScene &scene) {
+  using namespace detail;
+  MappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  const char *begin = reinterpret_cast<const char *>(file.data());
+  const char *end = begin + file.size();
+
+  // chunks of at least 1 MiB, a few per worker for load balance.
+  constexpr size_t MIN_CHUNK = 1 << 20;
+  size_t n_chunks = std::max<size_t>(
+    1, std::min(worker_pool().size() * 4, file.size() / MIN_CHUNK));
+  std::vector<const char *> bounds = {begin};
+  for (size_t i = 1; i < n_chunks; i++) {
+    const char *p = std::max(bounds.back(), begin + file.size() * i / n_chunks);
+    const char *newline =
+      static_cast<const char *>(std::memchr(p, '\n', end - p));
+    if (!newline) {
+      break;
+    }
+    bounds.push_back(newline + 1);
+  }
+  bounds.push_back(end);
+
+  std::vector<ObjChunk> chunks(bounds.size() - 1);
+  std::vector<std::future<void>> jobs;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    const char *from = bounds[i], *to = bounds[i + 1];
+    ObjChunk *chunk = &chunks[i];
+    jobs.push_back(worker_pool().submit(
+      [from, to, chunk] { obj_parse_chunk(from, to, *chunk); }));
+  }
+  for (auto &job : jobs) {
+    job.get();
+  }
+
+  // concatenate, rebasing chunk-relative indices and events.
+  size_t n_positions = 0, n_tex_coords = 0, n_normals = 0, n_corners = 0;
+  for (const ObjChunk &chunk : chunks) {
+    n_positions += chunk.positions.size();
+    n_tex_coords += chunk.tex_coords.size();
+    n_normals += chunk.normals.size();
+    n_corners += chunk.corners.size();
+  }
+  scene.positions.reserve(n_positions);
+  scene.tex_coords.reserve(n_tex_coords);
+  scene.normals.reserve(n_normals);
+  scene.corners.reserve(n_corners);
+
+  std::vector<ObjEvent> events;
+  std::vector<std::string> libraries;
+  for (ObjChunk &chunk : chunks) {
+    const int32_t base[3] = {(int32_t)scene.positions.size(),
+                             (int32_t)scene.tex_coords.size(),
+                             (int32_t)scene.normals.size()};
+    size_t corner_base = scene.corners.size();
+    scene.positions.insert(scene.positions.end(), chunk.positions.begin(),
+                           chunk.positions.end());
+    scene.tex_coords.insert(scene.tex_coords.end(), chunk.tex_coords.begin(),
+                            chunk.tex_coords.end());
+    scene.normals.insert(scene.normals.end(), chunk.normals.begin(),
+                         chunk.normals.end());
+    scene.corners.insert(scene.corners.end(), chunk.corners.begin(),
+                         chunk.corners.end());
+    for (size_t slot : chunk.relative) {
+      ObjCorner &corner = scene.corners[corner_base + slot / 3];
+      int32_t *index[3] = {&corner.v, &corner.vt, &corner.vn};
+      *index[slot % 3] += base[slot % 3];
+    }
+    for (ObjEvent &event : chunk.events) {
+      event.corner += corner_base;
+      events.push_back(std::move(event));
+    }
+    libraries.insert(libraries.end(), chunk.material_libraries.begin(),
+                     chunk.material_libraries.end());
+    chunk = ObjChunk();
+  }
+
+  std::string directory = path.substr(0, path.find_last_of('/'));
+  for (const std::string &library : libraries) {
+    if (!obj_parse_mtl(directory + "/" + library, scene.materials)) {
+      fprintf(stderr, "Failed to load material library: %s\n",
+              library.c_str());
+    }
+  }
+  std::unordered_map<std::string, uint32_t> material_index;
+  for (size_t i = 0; i < scene.materials.size(); i++) {
+    material_index.emplace(scene.materials[i].name, i);
+  }
+
+  // a new group at every o/g/usemtl, as long as the current one has faces.
+  uint32_t material = ObjGroup::NO_MATERIAL;
+  size_t start = 0;
+  auto close_group = [&](size_t at) {
+    if (at > start) {
+      scene.groups.push_back({material, start, at});
+    }
+    start = at;
+  };
+  for (const ObjEvent &event : events) {
+    close_group(event.corner);
+    if (event.kind == ObjEvent::MATERIAL) {
+      auto it = material_index.find(event.name);
+      material = it != material_index.end() ? it->second
+                                            : ObjGroup::NO_MATERIAL;
+    }
+  }
+  close_group(scene.corners.size());
+  return true;
+}
+
+// Builds indexed geometry for one group; corners with the same v/vt/vn share
+// a vertex. Safe to run for several groups in parallel.
+inline MeshData obj_mesh_data(const ObjScene &scene, const ObjGroup &group) {
+  MeshData data;
+  size_t n_corners = group.corner_end - group.corner_begin;
+  data.indices.reserve(n_corners);
+  data.vertices.reserve(n_corners / 2);
+
+  // open addressing table of first corners, keyed by their v/vt/vn triple.
+  size_t capacity = 16;
+  while (capacity < n_corners * 2) {
+    capacity *= 2;
+  }
+  std::vector<uint32_t> table(capacity, ~0u);
+  std::vector<uint32_t> corner_vertex(n_corners);
+  std::vector<bool> missing_normal;
+
+  auto valid = [](int32_t index, size_t count) {
+    return index >= 0 && (size_t)index < count;
+  };
+
+  for (size_t t = 0; t + 2 < n_corners; t += 3) {
+    const ObjCorner *tri = &scene.corners[group.corner_begin + t];
+    if (!valid(tri[0].v, scene.positions.size()) ||
+        !valid(tri[1].v, scene.positions.size()) ||
+        !valid(tri[2].v, scene.positions.size())) {
+      continue;
+    }
+
+    for (int k = 0; k < 3; k++) {
+      ObjCorner c = tri[k];
+      if (!valid(c.vt, scene.tex_coords.size())) {
+        c.vt = detail::OBJ_MISSING;
+      }
+      if (!valid(c.vn, scene.normals.size())) {
+        c.vn = detail::OBJ_MISSING;
+      }
+
+      uint32_t hash = (uint32_t)c.v * 0x9e3779b1u ^
+                      (uint32_t)c.vt * 0x85ebca77u ^
+                      (uint32_t)c.vn * 0xc2b2ae3du;
+      size_t slot = hash & (capacity - 1);
+      uint32_t vertex = ~0u;
+      for (;; slot = (slot + 1) & (capacity - 1)) {
+        if (table[slot] == ~0u) {
+          vertex = data.vertices.size();
+          table[slot] = t + k;
+          corner_vertex[t + k] = vertex;
+
+          Vertex v;
+          v.position = scene.positions[c.v];
+          v.normal = c.vn >= 0 ? scene.normals[c.vn] : glm::vec3(0.0f);
+          v.tex_coords = c.vt >= 0 ? scene.tex_coords[c.vt] : glm::vec2(0.0f);
+          data.vertices.push_back(v);
+          missing_normal.push_back(c.vn < 0);
+          break;
+        }
+        ObjCorner o = scene.corners[group.corner_begin + table[slot]];
+        if (!valid(o.vt, scene.tex_coords.size())) {
+          o.vt = detail::OBJ_MISSING;
+        }
+        if (!valid(o.vn, scene.normals.size())) {
+          o.vn = detail::OBJ_MISSING;
+        }
+        if (o.v == c.v && o.vt == c.vt && o.vn == c.vn) {
+          vertex = corner_vertex[table[slot]];
+          break;
+        }
+      }
+      data.indices.push_back(vertex);
+    }
+  }
+
+  // files without vn get smooth normals.
+  if (std::find(missing_normal.begin(), missing_normal.end(), true) !=
+      missing_normal.end()) {
+    data.compute_smooth_normals(missing_normal);
+  }
+
+  data.compute_bounds();
+  return data;
+}
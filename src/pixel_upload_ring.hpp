@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glad/glad.h>
+
+// Staging buffers for texture uploads: a small ring of pixel buffer objects
+// (PBOs) that are mapped on the GL thread, filled by any thread, and read by
+// glTexSubImage2D without the driver copying client memory synchronously.
+//
+// A slot cycles through free -> mapped (being filled) -> in flight (the GPU
+// may still read it, guarded by a fence) -> free. GL 3.3 has no persistent
+// mapping, so each use maps the slot again; GL_MAP_INVALIDATE_BUFFER_BIT
+// lets the driver hand out fresh memory instead of synchronizing.
+//
+// Every method is GL thread only, but the pointer returned by data() may be
+// written from any thread until unmap().
+class PixelUploadRing {
+public:
+  static constexpr int SLOTS = 4;
+  // larger images are uploaded from client memory instead.
+  static constexpr size_t MAX_SLOT_BYTES = 64 << 20;
+
+  PixelUploadRing() = default;
+  PixelUploadRing(const PixelUploadRing &) = delete;
+  PixelUploadRing &operator=(const PixelUploadRing &) = delete;
+
+  // Unmaps any mapped slot and deletes every buffer and fence, leaving the
+  // ring empty; it may be used again afterwards. Call it before the context
+  // goes away, once nothing writes into a mapping any more.
+  void destroy() {
+    for (Slot &slot : slots) {
+      if (slot.mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      }
+      if (slot.fence) {
+        glDeleteSync(slot.fence);
+      }
+      if (slot.buffer != 0) {
+        glDeleteBuffers(1, &slot.buffer);
+      }
+      slot = Slot();
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  // Maps a free slot with room for `bytes`. Returns its index, or -1 if
+  // every slot is busy, the image is too large or mapping failed.
+  int map(size_t bytes) {
+    if (bytes == 0 || bytes > MAX_SLOT_BYTES) {
+      return -1;
+    }
+    for (int i = 0; i < SLOTS; i++) {
+      Slot &slot = slots[i];
+      if (slot.mapped || !retire(slot)) {
+        continue;
+      }
+      if (slot.buffer == 0) {
+        glGenBuffers(1, &slot.buffer);
+      }
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+      if (slot.capacity < bytes) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        slot.capacity = bytes;
+      }
+      slot.mapped = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return slot.mapped ? i : -1;
+    }
+    return -1;
+  }
+
+  void *data(int slot) const { return slots[slot].mapped; }
+
+  // Unmaps `slot` and binds it to GL_PIXEL_UNPACK_BUFFER, so uploads read
+  // their pixels from offset 0 of it. False if the contents were lost while
+  // mapped; the slot is still bound and must be released.
+  bool unmap(int slot) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[slot].buffer);
+    slots[slot].mapped = nullptr;
+    return glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+  }
+
+  // Fences the uploads issued since unmap() and unbinds the slot. It is
+  // reused once the GPU has passed the fence.
+  void release(int slot) {
+    slots[slot].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+private:
+  struct Slot {
+    unsigned int buffer = 0;
+    size_t capacity = 0;
+    void *mapped = nullptr;
+    GLsync fence = nullptr;
+  };
+
+  Slot slots[SLOTS];
+
+  // true if the GPU is done with the slot's last contents.
+  static bool retire(Slot &slot) {
+    if (!slot.fence) {
+      return true;
+    }
+    GLenum status = glClientWaitSync(slot.fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      return false;
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    return true;
+  }
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "geometry_codec.hpp"
+
+// Order-0 entropy coding of byte streams with rANS (range asymmetric numeral
+// systems), used as the last stage of the on-disk geometry codec.
+//
+// Symbol frequencies are quantized to 12 bits and stored up front. Two
+// coder states take alternate bytes, so the decoder's dependency chains
+// interleave. Decoding is a table lookup, a multiply and a renormalization
+// per byte.
+//
+// Stream: uint8 mode, varint decoded size, then either the bytes (mode
+// RAW, for data that does not compress) or a varint symbol count, (uint8
+// symbol, varint frequency) per symbol, and the rANS bytes starting with
+// both final coder states.
+
+namespace detail {
+
+constexpr uint32_t RANS_PROB_BITS = 12;
+constexpr uint32_t RANS_PROB_SCALE = 1u << RANS_PROB_BITS;
+// lower bound of the normalized state interval.
+constexpr uint32_t RANS_LOW = 1u << 23;
+
+enum RansMode : uint8_t { RANS_MODE_RAW = 0, RANS_MODE_CODED = 1 };
+
+// scales byte counts to frequencies summing to RANS_PROB_SCALE, keeping
+// every present symbol at 1 or more.
+inline void rans_normalize(const uint64_t counts[256], size_t total,
+                           uint32_t freqs[256]) {
+  uint32_t sum = 0;
+  int largest = 0;
+  for (int s = 0; s < 256; s++) {
+    freqs[s] = counts[s] == 0 ? 0
+                              : std::max<uint32_t>(
+                                  1, counts[s] * RANS_PROB_SCALE / total);
+    sum += freqs[s];
+    if (freqs[s] > freqs[largest]) {
+      largest = s;
+    }
+  }
+  // rounding leaves the sum off by a little; the largest symbol absorbs it,
+  // and any excess it cannot absorb comes off the next largest ones.
+  if (sum <= RANS_PROB_SCALE || freqs[largest] > sum - RANS_PROB_SCALE) {
+    freqs[largest] += RANS_PROB_SCALE;
+    freqs[largest] -= sum;
+    return;
+  }
+  while (sum > RANS_PROB_SCALE) {
+    int s = (int)(std::max_element(freqs, freqs + 256) - freqs);
+    uint32_t take = std::min(freqs[s] - 1, sum - RANS_PROB_SCALE);
+    freqs[s] -= take;
+    sum -= take;
+  }
+}
+
+} // namespace detail
+
+inline void rans_encode(const uint8_t *data, size_t size,
+                        std::vector<uint8_t> &out) {
+  using namespace detail;
+  size_t header = out.size();
+  auto store_raw = [&] {
+    out.resize(header);
+    out.push_back(RANS_MODE_RAW);
+    put_varint(out, (uint32_t)size);
+    out.insert(out.end(), data, data + size);
+  };
+  if (size == 0) {
+    store_raw();
+    return;
+  }
+
+  uint64_t counts[256] = {};
+  for (size_t i = 0; i < size; i++) {
+    counts[data[i]]++;
+  }
+  uint32_t freqs[256], starts[256];
+  rans_normalize(counts, size, freqs);
+  uint32_t start = 0;
+  for (int s = 0; s < 256; s++) {
+    starts[s] = start;
+    start += freqs[s];
+  }
+
+  out.push_back(RANS_MODE_CODED);
+  put_varint(out, (uint32_t)size);
+  uint32_t symbols = 0;
+  for (int s = 0; s < 256; s++) {
+    symbols += freqs[s] != 0;
+  }
+  put_varint(out, symbols);
+  for (int s = 0; s < 256; s++) {
+    if (freqs[s] != 0) {
+      out.push_back((uint8_t)s);
+      put_varint(out, freqs[s]);
+    }
+  }
+
+  // rANS encodes back to front; bytes are collected reversed and flipped
+  // at the end so the decoder reads forwards.
+  std::vector<uint8_t> reversed;
+  reversed.reserve(size + 8);
+  uint32_t states[2] = {RANS_LOW, RANS_LOW};
+  for (size_t i = size; i-- > 0;) {
+    uint32_t &x = states[i & 1];
+    uint32_t freq = freqs[data[i]];
+    uint32_t x_max = ((RANS_LOW >> RANS_PROB_BITS) << 8) * freq;
+    while (x >= x_max) {
+      reversed.push_back((uint8_t)x);
+      x >>= 8;
+    }
+    x = ((x / freq) << RANS_PROB_BITS) + (x % freq) + starts[data[i]];
+  }
+  for (int k = 1; k >= 0; k--) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      reversed.push_back((uint8_t)(states[k] >> shift));
+    }
+  }
+  if (out.size() + reversed.size() >= header + size + 6) {
+    store_raw();
+    return;
+  }
+  out.insert(out.end(), reversed.rbegin(), reversed.rend());
+}
+
+// Decodes a whole stream from [data, data + size) into `out`. False on
+// malformed or truncated input.
+inline bool rans_decode(const uint8_t *data, size_t size,
+                        std::vector<uint8_t> &out) {
+  using namespace detail;
+  const uint8_t *p = data, *end = data + size;
+  uint32_t decoded_size;
+  if (p == end) {
+    return false;
+  }
+  uint8_t mode = *p++;
+  if (!get_varint(p, end, decoded_size)) {
+    return false;
+  }
+  out.resize(decoded_size);
+  if (mode == RANS_MODE_RAW) {
+    if ((size_t)(end - p) != decoded_size) {
+      return false;
+    }
+    std::copy(p, end, out.begin());
+    return true;
+  }
+  if (mode != RANS_MODE_CODED) {
+    return false;
+  }
+
+  uint32_t symbols;
+  if (!get_varint(p, end, symbols) || symbols == 0 || symbols > 256) {
+    return false;
+  }
+  // per slot: symbol in bits 0-7, frequency in 8-19 (a frequency of 4096
+  // wraps to 0, which only a single-symbol stream has) and the slot's offset
+  // into its symbol's range in 20-31.
+  uint32_t freqs[256] = {};
+  uint32_t slots[RANS_PROB_SCALE];
+  uint32_t start = 0;
+  for (uint32_t i = 0; i < symbols; i++) {
+    uint32_t freq;
+    if (p == end) {
+      return false;
+    }
+    uint8_t symbol = *p++;
+    if (!get_varint(p, end, freq) || freq == 0 ||
+        freq > RANS_PROB_SCALE - start || freqs[symbol] != 0) {
+      return false;
+    }
+    freqs[symbol] = freq;
+    for (uint32_t k = 0; k < freq; k++) {
+      slots[start + k] = symbol | (freq & (RANS_PROB_SCALE - 1)) << 8 |
+                         k << 20;
+    }
+    start += freq;
+  }
+  if (start != RANS_PROB_SCALE || end - p < 8) {
+    return false;
+  }
+
+  auto read_state = [&] {
+    uint32_t x = (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                 (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    p += 4;
+    return x;
+  };
+  uint32_t x0 = read_state();
+  uint32_t x1 = read_state();
+  // each step reads at most two bytes, so the bounds check is per pair of
+  // steps rather than per byte.
+  auto advance = [&](uint32_t x, uint8_t *dst) {
+    uint32_t entry = slots[x & (RANS_PROB_SCALE - 1)];
+    uint32_t freq = (entry >> 8) & (RANS_PROB_SCALE - 1);
+    *dst = (uint8_t)entry;
+    // a zero frequency stands for the whole range: x keeps its low bits.
+    return freq == 0 ? x : freq * (x >> RANS_PROB_BITS) + (entry >> 20);
+  };
+  auto step = [&](uint32_t &x, uint8_t *dst) {
+    x = advance(x, dst);
+    // branch-free: whether a byte is needed is close to random.
+    for (int k = 0; k < 2; k++) {
+      bool refill = x < RANS_LOW;
+      x = refill ? (x << 8) | *p : x;
+      p += refill;
+    }
+  };
+  uint8_t *dst = out.data();
+  size_t i = 0;
+  for (; i + 2 <= decoded_size; i += 2) {
+    if (end - p < 4) {
+      break;
+    }
+    step(x0, dst + i);
+    step(x1, dst + i + 1);
+  }
+  for (; i < decoded_size; i++) {
+    uint32_t &x = i & 1 ? x1 : x0;
+    x = advance(x, dst + i);
+    while (x < RANS_LOW) {
+      if (p == end) {
+        return false;
+      }
+      x = (x << 8) | *p++;
+    }
+  }
+  // a well-formed stream ends with both coders back at their initial state.
+  return p == end && x0 == RANS_LOW && x1 == RANS_LOW;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define LEARNGL_RAYCAST_SSE 1
+#endif
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+
+// Ray queries against the BVHs of bvh.hpp.
+//
+// Hit distances are in units of the ray direction, which need not be unit
+// length. Affine transforms keep them, so a ray moved into a mesh's space
+// reports the same t as in world space and hits from different spaces
+// compare directly.
+struct Ray {
+  glm::vec3 origin;
+  glm::vec3 direction;
+  // hits at or beyond t_max are ignored.
+  float t_max = FLT_MAX;
+};
+
+inline Ray transform_ray(const Ray &ray, const glm::mat4 &m) {
+  return {glm::vec3(m * glm::vec4(ray.origin, 1.0f)),
+          glm::vec3(m * glm::vec4(ray.direction, 0.0f)), ray.t_max};
+}
+
+struct TriangleHit {
+  float t = FLT_MAX;
+  // level 0 triangle of the mesh: indices 3 * triangle .. 3 * triangle + 2.
+  uint32_t triangle = 0;
+  // barycentric weights of the second and third vertex.
+  float u = 0.0f;
+  float v = 0.0f;
+};
+
+namespace detail {
+
+// entry distance of the ray into a node box, or FLT_MAX if it misses it
+// before t_max.
+inline float ray_box(const glm::vec3 &origin, const glm::vec3 &inv_direction,
+                     const BvhNode &node, float t_max) {
+  glm::vec3 t0 = (node.min - origin) * inv_direction;
+  glm::vec3 t1 = (node.max - origin) * inv_direction;
+  glm::vec3 near = glm::min(t0, t1);
+  glm::vec3 far = glm::max(t0, t1);
+  float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+  float exit = std::min(std::min(far.x, far.y), std::min(far.z, t_max));
+  return enter <= exit ? enter : FLT_MAX;
+}
+
+// Front-to-back walk of `bvh` along `ray`: the nearer child is visited
+// first and subtrees entered beyond `t_max` are skipped, so the walk
+// narrows as `leaf(first, count, t_max)` reports closer hits by lowering
+// t_max.
+template <typename Leaf>
+void traverse_ray(const Bvh &bvh, const Ray &ray, float &t_max, Leaf leaf) {
+  if (bvh.empty()) {
+    return;
+  }
+  glm::vec3 inv_direction = 1.0f / ray.direction;
+  if (ray_box(ray.origin, inv_direction, bvh.nodes[0], t_max) == FLT_MAX) {
+    return;
+  }
+
+  uint32_t stack[Bvh::MAX_DEPTH];
+  float stack_t[Bvh::MAX_DEPTH];
+  uint32_t depth = 0;
+  uint32_t index = 0;
+  for (;;) {
+    const BvhNode &node = bvh.nodes[index];
+    if (node.leaf()) {
+      leaf(node.first, node.count, t_max);
+    } else {
+      uint32_t near = node.first, far = node.first + 1;
+      float t_near = ray_box(ray.origin, inv_direction, bvh.nodes[near], t_max);
+      float t_far = ray_box(ray.origin, inv_direction, bvh.nodes[far], t_max);
+      if (t_far < t_near) {
+        std::swap(near, far);
+        std::swap(t_near, t_far);
+      }
+      if (t_near != FLT_MAX) {
+        if (t_far != FLT_MAX) {
+          stack[depth] = far;
+          stack_t[depth++] = t_far;
+        }
+        index = near;
+        continue;
+      }
+    }
+
+    // next pending subtree still in front of the closest hit.
+    do {
+      if (depth == 0) {
+        return;
+      }
+      depth--;
+    } while (stack_t[depth] >= t_max);
+    index = stack[depth];
+  }
+}
+
+// Möller-Trumbore against triangles [first, first + count) of the leaf
+// order, both sides. Updates `hit` and t_max on a closer hit.
+inline void intersect_triangles(const TriangleBvh &bvh, const Ray &ray,
+                                uint32_t first, uint32_t count, float &t_max,
+                                TriangleHit &hit, bool &found) {
+  const glm::vec3 *positions = bvh.positions.data();
+  const uint32_t *triangles = bvh.triangles.data() + first * 3;
+#ifdef LEARNGL_RAYCAST_SSE
+  // four triangles per step, one per lane.
+  const __m128 ox = _mm_set1_ps(ray.origin.x);
+  const __m128 oy = _mm_set1_ps(ray.origin.y);
+  const __m128 oz = _mm_set1_ps(ray.origin.z);
+  const __m128 dx = _mm_set1_ps(ray.direction.x);
+  const __m128 dy = _mm_set1_ps(ray.direction.y);
+  const __m128 dz = _mm_set1_ps(ray.direction.z);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 epsilon = _mm_set1_ps(1e-12f);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  for (uint32_t base = 0; base < count; base += 4) {
+    // structure of arrays: v0, e1 = v1 - v0, e2 = v2 - v0. lanes past the
+    // end repeat the last triangle.
+    alignas(16) float soa[9][4];
+    for (uint32_t lane = 0; lane < 4; lane++) {
+      const uint32_t *tri = triangles + std::min(base + lane, count - 1) * 3;
+      const glm::vec3 &a = positions[tri[0]];
+      glm::vec3 e1 = positions[tri[1]] - a;
+      glm::vec3 e2 = positions[tri[2]] - a;
+      for (int k = 0; k < 3; k++) {
+        soa[k][lane] = a[k];
+        soa[3 + k][lane] = e1[k];
+        soa[6 + k][lane] = e2[k];
+      }
+    }
+    __m128 e1x = _mm_load_ps(soa[3]), e1y = _mm_load_ps(soa[4]),
+           e1z = _mm_load_ps(soa[5]);
+    __m128 e2x = _mm_load_ps(soa[6]), e2y = _mm_load_ps(soa[7]),
+           e2z = _mm_load_ps(soa[8]);
+
+    // p = d x e2, det = e1 . p
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+      _mm_mul_ps(e1z, pz));
+    __m128 valid = _mm_cmpgt_ps(_mm_andnot_ps(sign, det), epsilon);
+    __m128 inv_det = _mm_div_ps(one, det);
+
+    // s = o - v0, u = (s . p) / det
+    __m128 sx = _mm_sub_ps(ox, _mm_load_ps(soa[0]));
+    __m128 sy = _mm_sub_ps(oy, _mm_load_ps(soa[1]));
+    __m128 sz = _mm_sub_ps(oz, _mm_load_ps(soa[2]));
+    __m128 u = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)),
+                 _mm_mul_ps(sz, pz)),
+      inv_det);
+
+    // q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 v = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)),
+                 _mm_mul_ps(dz, qz)),
+      inv_det);
+    __m128 t = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+                 _mm_mul_ps(e2z, qz)),
+      inv_det);
+
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, zero));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(t_max)));
+    int mask = _mm_movemask_ps(valid);
+    if (mask == 0) {
+      continue;
+    }
+
+    alignas(16) float ts[4], us[4], vs[4];
+    _mm_store_ps(ts, t);
+    _mm_store_ps(us, u);
+    _mm_store_ps(vs, v);
+    for (uint32_t lane = 0; lane < 4 && base + lane < count; lane++) {
+      if ((mask >> lane & 1) && ts[lane] < t_max) {
+        t_max = ts[lane];
+        hit = {ts[lane], bvh.bvh.primitives[first + base + lane], us[lane],
+               vs[lane]};
+        found = true;
+      }
+    }
+  }
+#else
+  for (uint32_t i = 0; i < count; i++) {
+    const uint32_t *tri = triangles + i * 3;
+    const glm::vec3 &a = positions[tri[0]];
+    glm::vec3 e1 = positions[tri[1]] - a;
+    glm::vec3 e2 = positions[tri[2]] - a;
+    glm::vec3 p = glm::cross(ray.direction, e2);
+    float det = glm::dot(e1, p);
+    if (std::abs(det) <= 1e-12f) {
+      continue;
+    }
+    float inv_det = 1.0f / det;
+    glm::vec3 s = ray.origin - a;
+    float u = glm::dot(s, p) * inv_det;
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(ray.direction, q) * inv_det;
+    float t = glm::dot(e2, q) * inv_det;
+    if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < t_max) {
+      t_max = t;
+      hit = {t, bvh.bvh.primitives[first + i], u, v};
+      found = true;
+    }
+  }
+#endif
+}
+
+} // namespace detail
+
+// Closest hit of `ray` with the triangles of `bvh`, in the BVH's space.
+// Returns false and leaves `hit` alone if there is none before ray.t_max.
+inline bool raycast(const TriangleBvh &bvh, const Ray &ray, TriangleHit &hit) {
+  float t_max = ray.t_max;
+  bool found = false;
+  detail::traverse_ray(bvh.bvh, ray, t_max,
+                       [&](uint32_t first, uint32_t count, float &t) {
+                         detail::intersect_triangles(bvh, ray, first, count,
+                                                     t, hit, found);
+                       });
+  return found;
+}
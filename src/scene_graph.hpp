@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Node hierarchy of a model, flattened into parallel arrays. Nodes are stored
+// in topological order (every parent before its children), so world
+// transforms are brought up to date by one forward pass over contiguous
+// matrices, with no recursion or pointer chasing.
+//
+// set_local() marks a node dirty; update() recomputes the world transforms
+// of dirty nodes and everything below them and leaves the rest untouched.
+class SceneGraph {
+public:
+  static constexpr uint32_t NO_PARENT = ~0u;
+
+  // `parent` must already exist (or be NO_PARENT). Returns the new node.
+  uint32_t add_node(uint32_t parent, const glm::mat4 &local) {
+    uint32_t node = parents.size();
+    parents.push_back(parent);
+    locals.push_back(local);
+    worlds.push_back(local);
+    dirty.push_back(1);
+    any_dirty = true;
+    return node;
+  }
+
+  size_t size() const { return parents.size(); }
+  bool empty() const { return parents.empty(); }
+
+  uint32_t parent(uint32_t node) const { return parents[node]; }
+  const glm::mat4 &local(uint32_t node) const { return locals[node]; }
+  // valid after update().
+  const glm::mat4 &world(uint32_t node) const { return worlds[node]; }
+
+  void set_local(uint32_t node, const glm::mat4 &local) {
+    locals[node] = local;
+    dirty[node] = 1;
+    any_dirty = true;
+  }
+
+  // returns true if any world transform changed.
+  bool update() {
+    if (!any_dirty) {
+      return false;
+    }
+    size_t n = parents.size();
+    // a parent's flag is final before its children are visited, so one pass
+    // both propagates dirtiness down and recomputes.
+    for (size_t i = 0; i < n; i++) {
+      uint32_t p = parents[i];
+      if (p != NO_PARENT) {
+        dirty[i] |= dirty[p];
+      }
+      if (dirty[i]) {
+        worlds[i] = p != NO_PARENT ? worlds[p] * locals[i] : locals[i];
+      }
+    }
+    std::fill(dirty.begin(), dirty.end(), 0);
+    any_dirty = false;
+    return true;
+  }
+
+private:
+  std::vector<uint32_t> parents;
+  std::vector<glm::mat4> locals;
+  std::vector<glm::mat4> worlds;
+  std::vector<uint8_t> dirty;
+  bool any_dirty = false;
+};
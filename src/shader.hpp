@@ -1,37 +1,134 @@
 #pragma once
 
 #include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <vector>
 
+#include "asset_cache.hpp"
+#include "load_profiler.hpp"
 #include "texture.hpp"
 
+namespace detail {
+
+// Program binaries need GL 4.1 or ARB_get_program_binary, beyond what the GL
+// 3.3 loader provides, so the entry points are looked up here. Drivers that
+// report no binary formats (macOS) count as unsupported.
+struct ProgramBinaryApi {
+  static constexpr GLenum RETRIEVABLE_HINT = 0x8257;
+  static constexpr GLenum BINARY_LENGTH = 0x8741;
+  static constexpr GLenum NUM_BINARY_FORMATS = 0x87FE;
+
+  void(APIENTRYP get_program_binary)(GLuint, GLsizei, GLsizei *, GLenum *,
+                                     void *) = nullptr;
+  void(APIENTRYP program_binary)(GLuint, GLenum, const void *,
+                                 GLsizei) = nullptr;
+  void(APIENTRYP program_parameteri)(GLuint, GLenum, GLint) = nullptr;
+
+  bool available() const { return program_binary != nullptr; }
+
+  // GL thread, with a current context.
+  static const ProgramBinaryApi &get() {
+    static const ProgramBinaryApi api = load();
+    return api;
+  }
+
+private:
+  static ProgramBinaryApi load() {
+    ProgramBinaryApi api;
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool supported = major > 4 || (major == 4 && minor >= 1);
+    GLint extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions && !supported; i++) {
+      const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+      supported = name && std::strcmp(name, "GL_ARB_get_program_binary") == 0;
+    }
+    GLint formats = 0;
+    if (supported) {
+      glGetIntegerv(NUM_BINARY_FORMATS, &formats);
+    }
+    if (formats <= 0) {
+      return api;
+    }
+
+    api.get_program_binary = (decltype(api.get_program_binary))
+      glfwGetProcAddress("glGetProgramBinary");
+    api.program_binary =
+      (decltype(api.program_binary))glfwGetProcAddress("glProgramBinary");
+    api.program_parameteri = (decltype(api.program_parameteri))
+      glfwGetProcAddress("glProgramParameteri");
+    if (!api.get_program_binary || !api.program_binary ||
+        !api.program_parameteri) {
+      api = ProgramBinaryApi();
+    }
+    return api;
+  }
+};
+
+} // namespace detail
+
+// bump to drop every cached program binary.
+constexpr uint32_t PROGRAM_CACHE_VERSION = 1;
+
 class Shader {
 public:
   unsigned int id;
 
   Shader(const char *vertex_path, const char *fragment_path) {
-    auto vs_src = read_file_to_string(vertex_path);
-    auto fs_src = read_file_to_string(fragment_path);
+    std::string asset = std::string(vertex_path) + " + " + fragment_path;
+    std::optional<std::string> vs_src, fs_src;
+    {
+      ScopedTimer timer(asset, "read");
+      vs_src = read_file_to_string(vertex_path);
+      fs_src = read_file_to_string(fragment_path);
+    }
 
-    unsigned int vertex =
-      compile_shader(vs_src.value().c_str(), GL_VERTEX_SHADER);
-    unsigned int fragment =
-      compile_shader(fs_src.value().c_str(), GL_FRAGMENT_SHADER);
+    // linked programs are cached per driver, since binaries are only valid
+    // for the one that produced them.
+    uint64_t key = program_key(vs_src.value(), fs_src.value());
+    {
+      ScopedTimer timer(asset, "cache read");
+      if (load_program_binary(key)) {
+        return;
+      }
+    }
 
-    id = glCreateProgram();
-    glAttachShader(id, vertex);
-    glAttachShader(id, fragment);
-    glLinkProgram(id);
-    check_link_errors(id);
+    unsigned int vertex, fragment;
+    {
+      ScopedTimer timer(asset, "compile");
+      vertex = compile_shader(vs_src.value().c_str(), GL_VERTEX_SHADER);
+      fragment = compile_shader(fs_src.value().c_str(), GL_FRAGMENT_SHADER);
+    }
+
+    {
+      // the status query in check_link_errors waits for the link.
+      ScopedTimer timer(asset, "link");
+      id = glCreateProgram();
+      const detail::ProgramBinaryApi &api = detail::ProgramBinaryApi::get();
+      if (api.available()) {
+        api.program_parameteri(id, api.RETRIEVABLE_HINT, GL_TRUE);
+      }
+      glAttachShader(id, vertex);
+      glAttachShader(id, fragment);
+      glLinkProgram(id);
+      check_link_errors(id);
+    }
 
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+    store_program_binary(key);
   }
 
   void use() const { glUseProgram(id); }
@@ -104,6 +201,62 @@ public:
   }
 
 private:
+  static uint64_t program_key(const std::string &vertex,
+                              const std::string &fragment) {
+    std::string flags;
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      const char *value = (const char *)glGetString(name);
+      flags += value ? value : "";
+      flags += '\n';
+    }
+    std::string sources = vertex + '\0' + fragment;
+    return AssetCache::bytes_key(sources.data(), sources.size(), "program",
+                                 PROGRAM_CACHE_VERSION, flags);
+  }
+
+  // cache entry: uint32 binary format, then the binary.
+  bool load_program_binary(uint64_t key) {
+    const detail::ProgramBinaryApi &api = detail::ProgramBinaryApi::get();
+    std::vector<uint8_t> entry;
+    if (!api.available() || !asset_cache().load(key, "program", entry) ||
+        entry.size() <= sizeof(uint32_t)) {
+      return false;
+    }
+    uint32_t format;
+    std::memcpy(&format, entry.data(), sizeof(format));
+    id = glCreateProgram();
+    api.program_binary(id, format, entry.data() + sizeof(format),
+                       entry.size() - sizeof(format));
+    // a driver update invalidates binaries; compile from source then.
+    int success;
+    glGetProgramiv(id, GL_LINK_STATUS, &success);
+    if (!success) {
+      glDeleteProgram(id);
+      id = 0;
+    }
+    return success;
+  }
+
+  void store_program_binary(uint64_t key) const {
+    const detail::ProgramBinaryApi &api = detail::ProgramBinaryApi::get();
+    GLint length = 0;
+    if (!api.available() || !asset_cache().enabled()) {
+      return;
+    }
+    glGetProgramiv(id, api.BINARY_LENGTH, &length);
+    if (length <= 0) {
+      return;
+    }
+    std::vector<uint8_t> entry(sizeof(uint32_t) + length);
+    GLenum format;
+    api.get_program_binary(id, length, &length, &format,
+                           entry.data() + sizeof(uint32_t));
+    uint32_t stored_format = format;
+    std::memcpy(entry.data(), &stored_format, sizeof(stored_format));
+    entry.resize(sizeof(uint32_t) + length);
+    asset_cache().store(key, "program", entry.data(), entry.size());
+  }
+
   std::optional<std::string> read_file_to_string(const std::string &filename) {
     std::ifstream file(filename);
     if (!file.is_open()) {
@@ -1,18 +1,286 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
 #include <string>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
 #include <glad/glad.h>
 
+#include "asset_cache.hpp"
+#include "bc_encoder.hpp"
+#include "hash.hpp"
+#include "load_profiler.hpp"
+#include "mapped_file.hpp"
+
 enum class TextureType {
   UNSPECIFIED, // dude
   DIFFUSE,
   SPECULAR,
 };
 
+// bump to drop every cached decoded image.
+constexpr uint32_t IMAGE_CACHE_VERSION = 1;
+// bump to drop every cached block-compressed image.
+constexpr uint32_t BC_CACHE_VERSION = 1;
+
+// Decoded pixels, or a block-compressed mip chain made from them. Decoding
+// and compressing touch no GL state, so they can run on any thread.
+struct Image {
+  int width = 0;
+  int height = 0;
+  int n_channels = 0;
+  std::unique_ptr<unsigned char, void (*)(void *)> pixels{nullptr,
+                                                          stbi_image_free};
+  // once compressed: every mip level down to 1x1 in `format`, level 0
+  // first, and no `pixels`.
+  BcFormat format = BcFormat::NONE;
+  int levels = 0;
+  std::vector<uint8_t> blocks;
+  // cache key of the encoded bytes the pixels came from, 0 if unknown.
+  uint64_t source_key = 0;
+
+  // `flip` puts the first row of the file at the bottom, where GL expects
+  // it for OBJ-style texture coordinates. With `compress_as` the image is
+  // block compressed for that kind of texture.
+  static Image load(const char *path, bool flip = true,
+                    std::optional<TextureType> compress_as = std::nullopt) {
+    ScopedTimer timer(path, "decode");
+    MappedFile file;
+    if (!file.open(path)) {
+      return Image();
+    }
+    return decode(file.data(), file.size(), flip, compress_as);
+  }
+
+  // decodes an encoded image (PNG, JPEG, ...) held in memory. Decoded pixels
+  // and compressed images are kept in the asset cache, keyed by the encoded
+  // bytes, so a cached compressed image skips decoding altogether.
+  static Image decode(const unsigned char *data, size_t size, bool flip = true,
+                      std::optional<TextureType> compress_as = std::nullopt) {
+    uint64_t key = AssetCache::bytes_key(data, size, "image",
+                                         IMAGE_CACHE_VERSION,
+                                         flip ? "flip" : "");
+    Image image;
+    image.source_key = key;
+    if (compress_as && image.read_compressed(*compress_as)) {
+      return image;
+    }
+    if (image.read_cached(key)) {
+      if (compress_as) {
+        image.compress(*compress_as);
+      }
+      return image;
+    }
+    // the per-thread flag keeps concurrent decodes from racing on it.
+    stbi_set_flip_vertically_on_load_thread(flip);
+    image.pixels.reset(stbi_load_from_memory(data, (int)size, &image.width,
+                                             &image.height,
+                                             &image.n_channels, 0));
+    if (!image) {
+      return image;
+    }
+    // the pixels of a compressed image are not needed again.
+    if (compress_as) {
+      image.compress(*compress_as);
+    } else {
+      image.write_cached(key);
+    }
+    return image;
+  }
+
+  // Replaces the pixels by a block-compressed mip chain in the format for
+  // `type`: BC1 for colour (BC3 if any pixel is translucent), BC4 of the
+  // luminance for specular maps.
+  void compress(TextureType type) {
+    if (!pixels || format != BcFormat::NONE) {
+      return;
+    }
+    if (read_compressed(type)) {
+      pixels.reset();
+      return;
+    }
+    std::vector<uint8_t> rgba = expand_rgba();
+    BcFormat target =
+      type == TextureType::SPECULAR ? BcFormat::BC4 : BcFormat::BC1;
+    for (size_t i = 0; i < rgba.size(); i += 4) {
+      if (target == BcFormat::BC4) {
+        rgba[i] = (uint8_t)((rgba[i] * 77 + rgba[i + 1] * 150 +
+                             rgba[i + 2] * 29 + 128) >> 8);
+      } else if (target == BcFormat::BC1 && rgba[i + 3] != 255) {
+        target = BcFormat::BC3;
+      }
+    }
+    std::vector<uint8_t> encoded;
+    levels = encode_bc_mips(target, std::move(rgba), width, height, encoded);
+    blocks = std::move(encoded);
+    format = target;
+    pixels.reset();
+    write_compressed(type);
+  }
+
+  explicit operator bool() const { return pixels || !blocks.empty(); }
+
+  bool compressed() const { return format != BcFormat::NONE; }
+
+  // the pixels, or every compressed level.
+  const void *data() const {
+    return compressed() ? (const void *)blocks.data() : pixels.get();
+  }
+
+  size_t byte_size() const {
+    return compressed() ? blocks.size()
+                        : (size_t)width * height * n_channels;
+  }
+
+private:
+  // cache entry: CachedHeader, then width * height * channels bytes.
+  struct CachedHeader {
+    char magic[4];
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+  };
+
+  bool read_cached(uint64_t key) {
+    std::string path = asset_cache().find(key, "image");
+    MappedFile file;
+    CachedHeader header;
+    if (path.empty() || !file.open(path) || file.size() < sizeof(header)) {
+      return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, "LGIM", 4) != 0 || header.channels < 1 ||
+        header.channels > 4 || header.width > 65536 ||
+        header.height > 65536) {
+      return false;
+    }
+    size_t size = (size_t)header.width * header.height * header.channels;
+    if (file.size() != sizeof(header) + size) {
+      return false;
+    }
+    // stbi_image_free is free(), so the deleter stays the same.
+    unsigned char *pixels_copy = (unsigned char *)std::malloc(size);
+    if (!pixels_copy) {
+      return false;
+    }
+    std::memcpy(pixels_copy, file.data() + sizeof(header), size);
+    width = header.width;
+    height = header.height;
+    n_channels = header.channels;
+    pixels.reset(pixels_copy);
+    return true;
+  }
+
+  // the pixels as RGBA: grey replicated, alpha 255 where there is none.
+  std::vector<uint8_t> expand_rgba() const {
+    size_t count = (size_t)width * height;
+    std::vector<uint8_t> rgba(count * 4);
+    const unsigned char *src = pixels.get();
+    for (size_t i = 0; i < count; i++, src += n_channels) {
+      uint8_t *dst = rgba.data() + i * 4;
+      bool grey = n_channels < 3;
+      dst[0] = src[0];
+      dst[1] = grey ? src[0] : src[1];
+      dst[2] = grey ? src[0] : src[2];
+      dst[3] = n_channels == 2 ? src[1] : n_channels == 4 ? src[3] : 255;
+    }
+    return rgba;
+  }
+
+  // compressed entry: CompressedHeader, then every level's blocks.
+  struct CompressedHeader {
+    char magic[4];
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t levels;
+  };
+
+  uint64_t compressed_key(TextureType type) const {
+    return Hasher64(BC_CACHE_VERSION)
+      .update_value(source_key)
+      .update_value(type)
+      .digest();
+  }
+
+  bool read_compressed(TextureType type) {
+    if (source_key == 0) {
+      return false;
+    }
+    std::string path = asset_cache().find(compressed_key(type), "bcn");
+    MappedFile file;
+    CompressedHeader header;
+    if (path.empty() || !file.open(path) || file.size() < sizeof(header)) {
+      return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, "LGBC", 4) != 0 ||
+        header.format < (uint32_t)BcFormat::BC1 ||
+        header.format > (uint32_t)BcFormat::BC4 || header.width == 0 ||
+        header.height == 0 || header.width > 65536 || header.height > 65536 ||
+        header.channels < 1 || header.channels > 4) {
+      return false;
+    }
+    BcFormat stored = (BcFormat)header.format;
+    size_t size = 0;
+    uint32_t count = 0;
+    for (int w = header.width, h = header.height;; w = std::max(1, w / 2),
+             h = std::max(1, h / 2)) {
+      size += bc_level_bytes(stored, w, h);
+      count++;
+      if (w == 1 && h == 1) {
+        break;
+      }
+    }
+    if (header.levels != count || file.size() != sizeof(header) + size) {
+      return false;
+    }
+    blocks.assign(file.data() + sizeof(header), file.data() + file.size());
+    format = stored;
+    levels = count;
+    width = header.width;
+    height = header.height;
+    n_channels = header.channels;
+    return true;
+  }
+
+  void write_compressed(TextureType type) const {
+    if (!asset_cache().enabled() || source_key == 0) {
+      return;
+    }
+    CompressedHeader header = {{'L', 'G', 'B', 'C'}, (uint32_t)format,
+                               (uint32_t)width,      (uint32_t)height,
+                               (uint32_t)n_channels, (uint32_t)levels};
+    std::vector<uint8_t> entry(sizeof(header) + blocks.size());
+    std::memcpy(entry.data(), &header, sizeof(header));
+    std::memcpy(entry.data() + sizeof(header), blocks.data(), blocks.size());
+    asset_cache().store(compressed_key(type), "bcn", entry.data(),
+                        entry.size());
+  }
+
+  void write_cached(uint64_t key) const {
+    if (!asset_cache().enabled()) {
+      return;
+    }
+    CachedHeader header = {{'L', 'G', 'I', 'M'}, (uint32_t)width,
+                           (uint32_t)height, (uint32_t)n_channels};
+    std::vector<uint8_t> entry(sizeof(header) + byte_size());
+    std::memcpy(entry.data(), &header, sizeof(header));
+    std::memcpy(entry.data() + sizeof(header), pixels.get(), byte_size());
+    asset_cache().store(key, "image", entry.data(), entry.size());
+  }
+};
+
 class Texture {
 public:
   unsigned int id;
@@ -21,24 +289,98 @@ public:
 
   Texture(unsigned id, TextureType type): id(id), type(type), path("") {}
 
-  Texture(const char *texture_path, TextureType type = TextureType::UNSPECIFIED)
-    : type(type), path(texture_path) {
-    int width, height, n_channels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char *data =
-      stbi_load(texture_path, &width, &height, &n_channels, 0);
-    if (!data) {
-      fprintf(stderr, "Failed to load texture\n");
-      stbi_image_free(data);
-      return;
-    }
+  // textures from files come from texture_registry(), which decodes them
+  // off the GL thread.
+
+  // creates a mipmapped GL texture from an image, or replaces the contents
+  // of texture `id`. GL thread only.
+  static unsigned int upload(const Image &image, unsigned int id = 0) {
+    return upload(image, image.data(), id, false);
+  }
 
-    glGenTextures(1, &id);
+  // same from `data`, which is image.data() or, with a buffer bound to
+  // GL_PIXEL_UNPACK_BUFFER, the offset of a copy of it there. `same_size`
+  // overwrites the storage `id` already has instead of allocating it again.
+  static unsigned int upload(const Image &image, const void *data,
+                             unsigned int id, bool same_size) {
+    if (id == 0) {
+      glGenTextures(1, &id);
+      same_size = false;
+    }
     glBindTexture(GL_TEXTURE_2D, id);
-    auto mode = n_channels == 3 ? GL_RGB : GL_RGBA;
-    glTexImage2D(GL_TEXTURE_2D, 0, mode, width, height, 0, mode,
-                 GL_UNSIGNED_BYTE, data);
+    // GL's default, undoing the placeholder's filter that ignores mipmaps.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST_MIPMAP_LINEAR);
+    // BC4 and grey images hold only red, grey-alpha images alpha in green;
+    // lookups read all of rgba.
+    bool grey = image.compressed() ? image.format == BcFormat::BC4
+                                   : image.n_channels < 3;
+    bool grey_alpha = !image.compressed() && image.n_channels == 2;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G,
+                    grey ? GL_RED : GL_GREEN);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B,
+                    grey ? GL_RED : GL_BLUE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A,
+                    grey_alpha ? GL_GREEN : GL_ALPHA);
+    if (image.compressed()) {
+      upload_compressed(image, (const unsigned char *)data, same_size);
+      return id;
+    }
+    // the default, in case the texture held a compressed image before.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+    const GLenum modes[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    GLenum mode = modes[std::clamp(image.n_channels, 1, 4) - 1];
+    // rows of images with fewer than 4 channels are not 4-byte aligned in
+    // general.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (same_size) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, mode,
+                      GL_UNSIGNED_BYTE, data);
+    } else {
+      glTexImage2D(GL_TEXTURE_2D, 0, mode, image.width, image.height, 0, mode,
+                   GL_UNSIGNED_BYTE, data);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
+    return id;
+  }
+
+  // GL enum of a block-compressed format. BC1 and BC3 need
+  // GL_EXT_texture_compression_s3tc, which glad does not define.
+  static GLenum gl_format(BcFormat format) {
+    switch (format) {
+    case BcFormat::BC1:
+      return 0x83F0; // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    case BcFormat::BC3:
+      return 0x83F3; // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    case BcFormat::BC4:
+      return GL_COMPRESSED_RED_RGTC1;
+    case BcFormat::NONE:
+      break;
+    }
+    return GL_NONE;
+  }
+
+private:
+  // every level from `data`, where they follow each other; nothing is left
+  // for glGenerateMipmap.
+  static void upload_compressed(const Image &image, const unsigned char *data,
+                                bool same_size) {
+    GLenum format = gl_format(image.format);
+    int width = image.width, height = image.height;
+    for (int level = 0; level < image.levels; level++) {
+      GLsizei size = (GLsizei)bc_level_bytes(image.format, width, height);
+      if (same_size) {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height,
+                                  format, size, data);
+      } else {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0,
+                               size, data);
+      }
+      data += size;
+      width = std::max(1, width / 2);
+      height = std::max(1, height / 2);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels - 1);
   }
 };
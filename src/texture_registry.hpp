@@ -0,0 +1,428 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "hash.hpp"
+#include "mpsc_queue.hpp"
+#include "pixel_upload_ring.hpp"
+#include "texture.hpp"
+#include "thread_pool.hpp"
+
+// Process-wide set of textures loaded from files, shared between models.
+//
+// Entries are keyed by a hash of the normalized path. Any thread may ask for
+// a texture to be prefetched: the first request starts a decode on the worker
+// pool and later requests for the same file join it. Finished decodes go
+// into a lock-free queue that the GL thread drains in update() under a
+// per-frame time budget: it maps a PixelUploadRing slot, a worker copies the
+// pixels into it, and a later update() uploads from the slot, so neither
+// the pixel copy nor the transfer happens synchronously on the GL thread.
+//
+// With detect_compression(), decodes also bake the image into a
+// block-compressed mip chain for its TextureType (see Image::compress()),
+// cached on disk next to the decoded pixels, so textures take a quarter to
+// an eighth of the memory and bandwidth and warm starts skip decoding.
+//
+// acquire() never waits for pixels. It hands out a GL texture right away,
+// holding a 1x1 placeholder until update() uploads the real image into that
+// same texture, so meshes draw immediately and sharpen as images arrive.
+// The GL texture is deleted when the last reference is released, or by
+// shutdown() for those still held when the context goes away.
+//
+// reload() decodes a changed file again and update() replaces the pixels the
+// same way.
+class TextureRegistry {
+public:
+  static std::string normalize(const std::string &path) {
+    return std::filesystem::path(path).lexically_normal().generic_string();
+  }
+
+  // GL thread, once the context is current. Decodes started afterwards
+  // compress what the driver can sample: RGTC (BC4) is core, S3TC (BC1,
+  // BC3) an extension. LEARNGL_TEXTURE_COMPRESSION=off keeps every texture
+  // uncompressed.
+  void detect_compression() {
+    const char *setting = std::getenv("LEARNGL_TEXTURE_COMPRESSION");
+    bool enabled = !setting || std::strcmp(setting, "off") != 0;
+    bool s3tc = false;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count && !s3tc; i++) {
+      const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+      s3tc = name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    compress_rgtc = enabled;
+    compress_s3tc = enabled && s3tc;
+  }
+
+  // Starts decoding `path` unless it is already loading or loaded. `type`
+  // picks the compressed format; the first request for a file decides it.
+  void prefetch(const std::string &path,
+                TextureType type = TextureType::UNSPECIFIED) {
+    std::string normalized = normalize(path);
+    std::lock_guard<std::mutex> lock(mutex);
+    get_or_start(normalized, type);
+  }
+
+  // Like prefetch(path) for images that are not files of their own, such as
+  // those embedded in a model: `decode` runs on the worker pool and produces
+  // the pixels of `key`.
+  void prefetch(const std::string &key, std::function<Image()> decode,
+                TextureType type = TextureType::UNSPECIFIED) {
+    std::string normalized = normalize(key);
+    std::lock_guard<std::mutex> lock(mutex);
+    get_or_start(normalized, type, std::move(decode));
+  }
+
+  // GL thread only. Never blocks: until the image is uploaded, and for
+  // images that fail to load, the texture shows a placeholder for `type`.
+  Texture acquire(const std::string &path, TextureType type) {
+    std::string normalized = normalize(path);
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = get_or_start(normalized, type);
+    entry.refs++;
+    if (entry.id == 0) {
+      entry.id = placeholder(type);
+    }
+    Texture texture(entry.id, type);
+    texture.path = entry.path;
+    return texture;
+  }
+
+  // GL thread only. The 1x1 placeholder for `type` shared by everything that
+  // has no map of that type. The texture's path stays empty, which marks it
+  // as generated in the mesh cache; drop it with release_default().
+  Texture acquire_default(TextureType type) {
+    std::string path = default_path(type);
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = entries[find(path)];
+    if (entry.id == 0) {
+      entry.path = path;
+      entry.type = type;
+      entry.uploaded = true;
+      entry.id = placeholder(type);
+    }
+    entry.refs++;
+    return Texture(entry.id, type);
+  }
+
+  // GL thread only. Drops one reference taken by acquire_default().
+  void release_default(TextureType type) { release(default_path(type)); }
+
+  // GL thread only. Drops one reference taken by acquire().
+  void release(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(find(normalize(path)));
+    if (it == entries.end() || it->second.refs == 0) {
+      return;
+    }
+    if (--it->second.refs == 0) {
+      if (it->second.id != 0) {
+        glDeleteTextures(1, &it->second.id);
+      }
+      entries.erase(it);
+    }
+  }
+
+  // Starts decoding `path` again if it is loaded. Returns false if no
+  // texture uses it.
+  bool reload(const std::string &path) {
+    std::string normalized = normalize(path);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(find(normalized));
+    // one still decoding reads the new file anyway.
+    if (it == entries.end() || (!it->second.uploaded && !it->second.failed)) {
+      return false;
+    }
+    start_decode(it->first, normalized, it->second.type, nullptr);
+    return true;
+  }
+
+  // GL thread, once per frame. Issues the uploads whose pixels reached a
+  // staging buffer, then stages decoded images until roughly
+  // `budget_seconds` are spent (at least one) or every staging slot is busy.
+  void update(double budget_seconds = 0.002) {
+    auto start = std::chrono::steady_clock::now();
+    Decoded item;
+    while (staged.pop(item)) {
+      copying--;
+      finish_staged(item);
+    }
+    for (;;) {
+      if (waiting.empty()) {
+        if (!decoded.pop(item)) {
+          break;
+        }
+        waiting.push_back(std::move(item));
+      }
+      if (!stage(waiting.front())) {
+        break;
+      }
+      waiting.pop_front();
+      if (std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        start)
+            .count() >= budget_seconds) {
+        break;
+      }
+    }
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+  }
+
+  // GL thread, before the context goes away. Waits for the copies into
+  // staging buffers, then deletes the staging ring and every texture still
+  // held, so none is left for after glfwTerminate() or static destruction;
+  // releases after this are no-ops. Decodes still running are dropped when
+  // they finish.
+  void shutdown() {
+    Decoded item;
+    while (copying > 0) {
+      if (staged.pop(item)) {
+        copying--;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    ring.destroy();
+    waiting.clear();
+    while (decoded.pop(item)) {
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &[key, entry] : entries) {
+      if (entry.id != 0) {
+        glDeleteTextures(1, &entry.id);
+      }
+    }
+    entries.clear();
+  }
+
+private:
+  struct Entry {
+    std::string path;
+    TextureType type = TextureType::UNSPECIFIED;
+    // GL texture, a placeholder until `uploaded`; 0 until first acquired or
+    // uploaded. written on the GL thread only.
+    unsigned int id = 0;
+    unsigned int refs = 0;
+    bool uploaded = false;
+    bool failed = false;
+    // of the uploaded image, so a same-size reload reuses the storage.
+    int width = 0;
+    int height = 0;
+    int n_channels = 0;
+    BcFormat format = BcFormat::NONE;
+  };
+
+  // a finished decode on its way to the GL thread.
+  struct Decoded {
+    uint64_t key = 0;
+    std::string path;
+    std::unique_ptr<Image> image;
+    // staging slot holding a copy of the pixels, or -1.
+    int slot = -1;
+  };
+
+  // node-based, so references to entries survive rehashing.
+  std::unordered_map<uint64_t, Entry> entries;
+  MpscQueue<Decoded> decoded;
+  // copied into their staging slot, ready for the GL thread.
+  MpscQueue<Decoded> staged;
+  // GL thread: decoded images waiting for a free staging slot.
+  std::deque<Decoded> waiting;
+  // GL thread: copies handed to the worker pool and not yet popped from
+  // `staged`; their slots are still mapped.
+  size_t copying = 0;
+  PixelUploadRing ring;
+  mutable std::mutex mutex;
+  // formats the driver samples, once detect_compression() ran.
+  bool compress_rgtc = false;
+  bool compress_s3tc = false;
+
+  // key of `path`: its hash, linearly probed past the (unlikely) entries of
+  // colliding paths. caller holds the lock.
+  uint64_t find(const std::string &path) const {
+    uint64_t key = hash64(path);
+    for (auto it = entries.find(key);
+         it != entries.end() && it->second.path != path;
+         it = entries.find(++key)) {
+    }
+    return key;
+  }
+
+  // caller holds the lock. without `decode` the image is read from `path`.
+  Entry &get_or_start(const std::string &path, TextureType type,
+                      std::function<Image()> decode = nullptr) {
+    uint64_t key = find(path);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+      return it->second;
+    }
+
+    Entry &entry = entries[key];
+    entry.path = path;
+    entry.type = type;
+    start_decode(key, path, type, std::move(decode));
+    return entry;
+  }
+
+  // caller holds the lock.
+  void start_decode(uint64_t key, const std::string &path, TextureType type,
+                    std::function<Image()> decode) {
+    std::optional<TextureType> compress_as;
+    if (type == TextureType::SPECULAR ? compress_rgtc : compress_s3tc) {
+      compress_as = type;
+    }
+    if (!decode) {
+      decode = [path, compress_as] {
+        return Image::load(path.c_str(), true, compress_as);
+      };
+    }
+    worker_pool().submit([this, key, path, compress_as,
+                          decode = std::move(decode)] {
+      auto image = std::make_unique<Image>(decode());
+      if (compress_as && *image && !image->compressed()) {
+        ScopedTimer timer(path, "compress");
+        image->compress(*compress_as);
+      }
+      decoded.push({key, path, std::move(image)});
+    });
+  }
+
+  // GL thread. entries are only erased on this thread, so the result stays
+  // valid while the lock is dropped. null if the texture was released while
+  // its image was in flight.
+  Entry *lookup(const Decoded &item) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(item.key);
+    if (it == entries.end() || it->second.path != item.path) {
+      return nullptr;
+    }
+    return &it->second;
+  }
+
+  // GL thread. Maps a staging slot for a decoded image and has a worker copy
+  // its pixels or blocks into it. Failed decodes and images the ring cannot
+  // take are dealt with right away. False if every slot is busy.
+  //
+  // The decode cannot write into the slot itself. stb_image allocates its
+  // own output, and the size is only known once the file is decoded. Slots
+  // are mapped on this thread and there are only SLOTS of them, so mapping
+  // one before a decode would hold it for the whole decode. Compressed
+  // blocks are also written to the disk cache, and reading them back out of
+  // a write-only mapping is slow.
+  bool stage(Decoded &item) {
+    Entry *entry = lookup(item);
+    if (!entry) {
+      return true;
+    }
+    const Image *image = item.image.get();
+    if (!image || !*image) {
+      fprintf(stderr, "Failed to load texture: %s\n", item.path.c_str());
+      finish(*entry, entry->id, nullptr);
+      return true;
+    }
+    size_t bytes = image->byte_size();
+    if (bytes > PixelUploadRing::MAX_SLOT_BYTES) {
+      ScopedTimer timer(item.path, "upload");
+      finish(*entry, Texture::upload(*image, entry->id), image);
+      return true;
+    }
+
+    item.slot = ring.map(bytes);
+    if (item.slot < 0) {
+      return false;
+    }
+    void *destination = ring.data(item.slot);
+    copying++;
+    worker_pool().submit([this, destination, item = std::move(item)]() mutable {
+      std::memcpy(destination, item.image->data(), item.image->byte_size());
+      staged.push(std::move(item));
+    });
+    return true;
+  }
+
+  // GL thread. Uploads from the staging slot the worker filled.
+  void finish_staged(Decoded &item) {
+    // the driver may drop a mapping's contents, e.g. on a mode switch; the
+    // client copy is still there for that case.
+    bool intact = ring.unmap(item.slot);
+    Entry *entry = lookup(item);
+    if (entry) {
+      const Image &image = *item.image;
+      bool same_size = entry->uploaded && entry->width == image.width &&
+                       entry->height == image.height &&
+                       entry->n_channels == image.n_channels &&
+                       entry->format == image.format;
+      if (!intact) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      }
+      ScopedTimer timer(item.path, "upload");
+      // null: the data starts at offset 0 of the bound staging buffer.
+      finish(*entry,
+             Texture::upload(image, intact ? nullptr : image.data(), entry->id,
+                             same_size),
+             &image);
+    }
+    ring.release(item.slot);
+  }
+
+  // GL thread. Records texture `id` as holding `image`, or keeps what it
+  // had if the image failed to load (null).
+  void finish(Entry &entry, unsigned int id, const Image *image) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entry.id = id;
+    if (image) {
+      entry.uploaded = true;
+      entry.width = image->width;
+      entry.height = image->height;
+      entry.n_channels = image->n_channels;
+      entry.format = image->format;
+    }
+    entry.failed = !entry.uploaded;
+  }
+
+  // registry path of the default texture for `type`; no file is named so.
+  static std::string default_path(TextureType type) {
+    return "<default " + std::to_string((int)type) + ">";
+  }
+
+  // 1x1 stand-in: mid grey for colour maps, black (no highlights) for
+  // specular maps.
+  static unsigned int placeholder(TextureType type) {
+    unsigned char grey[] = {128, 128, 128, 255};
+    unsigned char black[] = {0, 0, 0, 255};
+    unsigned int id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 type == TextureType::SPECULAR ? black : grey);
+    // no mipmaps: with the default mipmapped filter it would be incomplete.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    return id;
+  }
+};
+
+inline TextureRegistry &texture_registry() {
+  static TextureRegistry registry;
+  return registry;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed-size pool of worker threads running tasks in FIFO order.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t n_threads) {
+    for (size_t i = 0; i < n_threads; i++) {
+      workers.emplace_back([this] { run(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  template <typename F>
+  std::future<std::invoke_result_t<F>> submit(F &&f) {
+    using R = std::invoke_result_t<F>;
+    // std::function must be copyable, packaged_task is not.
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    std::future<R> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.emplace_back([task] { (*task)(); });
+    }
+    wake.notify_one();
+    return result;
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  void run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (stopping && tasks.empty()) {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+};
+
+// Shared pool for loader work. Tasks running on it must not block on other
+// tasks submitted to it.
+inline ThreadPool &worker_pool() {
+  static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+// Calls f(i) for every i in [0, count) on the calling thread and the worker
+// pool. The caller claims items itself and only ever waits for items other
+// threads are already running, never for a queued task, so it is safe to
+// call from a pool task. Items should be coarse: each takes a lock.
+template <typename F> void parallel_for(size_t count, const F &f) {
+  struct Shared {
+    std::atomic<size_t> next{0};
+    size_t done = 0;
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+  auto shared = std::make_shared<Shared>();
+  // `f` is only touched for claimed items, which finish before this returns;
+  // helpers that start later find nothing left and touch only `shared`.
+  auto work = [shared, count, &f] {
+    for (size_t i; (i = shared->next.fetch_add(1)) < count;) {
+      f(i);
+      std::lock_guard<std::mutex> lock(shared->mutex);
+      if (++shared->done == count) {
+        shared->finished.notify_all();
+      }
+    }
+  };
+  size_t helpers = std::min(count, worker_pool().size()) - (count > 0);
+  for (size_t i = 0; i < helpers; i++) {
+    worker_pool().submit(work);
+  }
+  work();
+  std::unique_lock<std::mutex> lock(shared->mutex);
+  shared->finished.wait(lock, [&] { return shared->done == count; });
+}
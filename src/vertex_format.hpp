@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct Vertex {
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec2 tex_coords;
+};
+
+// how a mesh's vertices are laid out on the GPU. the host copy is always
+// `Vertex`.
+enum class VertexFormat { FLOAT, PACKED };
+
+// Compact 16-byte vertex, decoded in basic.vert:
+//   position   - unorm16 per axis, relative to the mesh AABB
+//   normal     - octahedral encoding, snorm16 x 2
+//   tex_coords - half floats
+struct PackedVertex {
+  uint16_t position[3];
+  uint16_t padding;
+  int16_t normal[2];
+  uint16_t tex_coords[2];
+};
+
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay 16 bytes");
+
+// half floats only carry 10 mantissa bits, so texture coordinates far from
+// the origin lose whole texels. meshes beyond this stay in the float format.
+constexpr float PACKED_UV_LIMIT = 2.0f;
+
+inline uint16_t float_to_half(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t biased = (x >> 23) & 0xff;
+  uint32_t mantissa = x & 0x7fffff;
+
+  if (biased == 0xff) { // inf / nan
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  int exponent = (int)biased - 127 + 15;
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+
+  // round to nearest even on the dropped bits.
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    uint32_t shift = 14 - exponent;
+    uint32_t h = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (h & 1))) {
+      h++;
+    }
+    return sign | h;
+  }
+
+  uint32_t h = sign | (exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) {
+    h++; // a carry into the exponent is still the correct rounding.
+  }
+  return h;
+}
+
+inline int16_t quantize_snorm16(float v) {
+  v = glm::clamp(v, -1.0f, 1.0f);
+  return (int16_t)std::lround(v * 32767.0f);
+}
+
+inline uint16_t quantize_unorm16(float v) {
+  v = glm::clamp(v, 0.0f, 1.0f);
+  return (uint16_t)std::lround(v * 65535.0f);
+}
+
+// octahedral normal encoding (Meyer et al.), in [-1, 1]^2.
+inline glm::vec2 oct_encode(glm::vec3 n) {
+  n /= std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+  glm::vec2 e(n.x, n.y);
+  if (n.z < 0.0f) {
+    e = glm::vec2((1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                  (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+  }
+  return e;
+}
+
+inline bool can_pack_vertices(const Vertex *vertices, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    const glm::vec2 &uv = vertices[i].tex_coords;
+    if (!(std::fabs(uv.x) <= PACKED_UV_LIMIT) ||
+        !(std::fabs(uv.y) <= PACKED_UV_LIMIT)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// the format a mesh asking for `requested` ends up with.
+inline VertexFormat resolve_vertex_format(VertexFormat requested,
+                                          const Vertex *vertices,
+                                          size_t count) {
+  if (requested == VertexFormat::PACKED && can_pack_vertices(vertices, count)) {
+    return VertexFormat::PACKED;
+  }
+  return VertexFormat::FLOAT;
+}
+
+// scale and offset that map unorm16 positions back into the AABB.
+inline glm::vec3 packed_position_scale(const glm::vec3 &aabb_min,
+                                       const glm::vec3 &aabb_max) {
+  return glm::max(aabb_max - aabb_min, glm::vec3(1e-20f));
+}
+
+inline std::vector<PackedVertex> pack_vertices(const Vertex *vertices,
+                                               size_t count,
+                                               const glm::vec3 &aabb_min,
+                                               const glm::vec3 &aabb_max) {
+  glm::vec3 scale = packed_position_scale(aabb_min, aabb_max);
+  std::vector<PackedVertex> packed(count);
+  for (size_t i = 0; i < count; i++) {
+    const Vertex &v = vertices[i];
+    PackedVertex &p = packed[i];
+
+    glm::vec3 t = (v.position - aabb_min) / scale;
+    for (int k = 0; k < 3; k++) {
+      p.position[k] = quantize_unorm16(t[k]);
+    }
+    p.padding = 0;
+
+    float length = glm::length(v.normal);
+    glm::vec2 e = length > 0.0f ? oct_encode(v.normal / length)
+                                : glm::vec2(0.0f, 0.0f);
+    p.normal[0] = quantize_snorm16(e.x);
+    p.normal[1] = quantize_snorm16(e.y);
+
+    p.tex_coords[0] = float_to_half(v.tex_coords.x);
+    p.tex_coords[1] = float_to_half(v.tex_coords.y);
+  }
+  return packed;
+}